@@ -0,0 +1,127 @@
+#!/usr/bin/env perl
+
+#------------------------------------------------------------------------------
+# Benchmark the bf engines
+# Runs each program under every engine and optimization level, checks its
+# output, and writes one tab-separated line per run to stdout:
+#   commit program engine level seconds ops ops_per_sec status
+# seconds is the best wall time of the repetitions, including compilation;
+# ops is the count of VM ops executed, as reported by bf -p.
+#
+# usage: perl bench/bench.pl [-n repeats] [-e engine,...] [program...]
+#------------------------------------------------------------------------------
+
+use strict;
+use warnings;
+use File::Path 'make_path';
+use Getopt::Long;
+use Time::HiRes qw(time);
+
+# name, source, input; sources other than .bf are compiled first. The BASIC
+# programs are written for the benchmark: examples/ only has the calculator
+my @programs = (
+	["mandelbrot", "bench/mandelbrot.bas", undef],
+	["hanoi",      "bench/hanoi.bas",      undef],
+	["factor",     "bench/factor.bas",     "bench/factor.in"],
+	["dbfi",       "bench/dbfi.bf",        "bench/dbfi.in"],
+	["calc",       "examples/calc.bfpp",   "bench/calc.in"],
+);
+
+# name, bf options
+my @levels = (
+	["O0",       "-O0"],
+	["O1",       "-O1"],
+	["O2",       "-O2"],
+	["O3",       "-O3"],
+	["pre-exec", "--pre-exec"],
+);
+
+my @engines = ("switch", "threaded", "jit", "tiered");
+my $repeats = 3;
+my $out_dir = "bench/out";
+
+GetOptions("n=i" => \$repeats,
+		   "e=s" => sub { @engines = split /,/, $_[1] })
+	and $repeats > 0
+	or die "usage: perl bench/bench.pl [-n repeats] [-e engine,...] [program...]\n";
+
+if (@ARGV) {
+	my %wanted = map {$_ => 1} @ARGV;
+	@programs = grep {$wanted{$_->[0]}} @programs;
+	@programs or die "No such program: @ARGV\n";
+}
+
+my $bf = -x "./bf.exe" ? "./bf.exe" : "./bf";
+my $commit = `git rev-parse --short HEAD 2>/dev/null` || "-";
+chomp($commit);
+
+make_path($out_dir);
+$| = 1;
+print join("\t", qw(commit program engine level seconds ops ops_per_sec status)), "\n";
+
+for (@programs) {
+	my($name, $source, $input) = @$_;
+	my $program = build($name, $source);
+	my $stdin = defined($input) ? "< $input" : "< /dev/null";
+	my $expected = slurp("bench/$name.out");
+
+	for (@levels) {
+		my($level, $opts) = @$_;
+		my $ops = count_ops($program, $opts, $stdin);
+
+		for my $engine (@engines) {
+			my $best;
+			my $status = "ok";
+			for (1 .. $repeats) {
+				my $start = time;
+				my $failed = system("$bf --engine=$engine $opts $program $stdin > $out_dir/$name.stdout");
+				my $seconds = time - $start;
+				if ($failed) {
+					$status = "error";
+				}
+				elsif (slurp("$out_dir/$name.stdout") ne $expected) {
+					$status = "wrong";
+				}
+				$best = $seconds if !defined($best) || $seconds < $best;
+			}
+			my $rate = $ops && $best > 0 ? int($ops / $best) : 0;
+			printf "%s\t%s\t%s\t%s\t%.3f\t%s\t%s\t%s\n",
+				$commit, $name, $engine, $level, $best, $ops, $rate, $status;
+		}
+	}
+}
+
+# compile the source down to Brainfuck in $out_dir
+sub build {
+	my($name, $source) = @_;
+	return $source if $source =~ /\.bf$/;
+
+	my $bfpp = "$out_dir/$name.bfpp";
+	if ($source =~ /\.bas$/) {
+		run("./bfbasic $source -o $bfpp");
+	}
+	else {
+		$bfpp = $source;
+	}
+	run("./bfpp $bfpp > $out_dir/$name.bf");
+	return "$out_dir/$name.bf";
+}
+
+# VM ops executed, from the profile
+sub count_ops {
+	my($program, $opts, $stdin) = @_;
+	my $profile = `$bf -p $opts $program $stdin 2>&1 >/dev/null`;
+	return $profile =~ /^Profile: (\d+) ops executed/m ? $1 : 0;
+}
+
+sub run {
+	my($cmd) = @_;
+	system($cmd) == 0 or die "Failed: $cmd\n";
+}
+
+sub slurp {
+	my($file) = @_;
+	open(my $fh, "<:raw", $file) or die "Cannot read $file: $!\n";
+	local $/;
+	return scalar <$fh>;
+}
@@ -0,0 +1,15 @@
+INPUT N
+WHILE N > 1
+  PRINT N; ":";
+  D = 2
+  WHILE D * D <= N
+    WHILE N MOD D = 0
+      PRINT " "; D;
+      N = N / D
+    WEND
+    D = D + 1
+  WEND
+  IF N > 1 THEN PRINT " "; N;
+  PRINT
+  INPUT N
+WEND
@@ -0,0 +1,14 @@
+N = 8
+DIM P(10)
+IF N MOD 2 = 0 THEN D = 1 ELSE D = 2
+M = 1
+WHILE M < 2 ^ N
+  K = 1 : R = M
+  WHILE R MOD 2 = 0
+    K = K + 1 : R = R / 2
+  WEND
+  F = P(K)
+  IF K MOD 2 = 1 THEN P(K) = (F + D) MOD 3 ELSE P(K) = (F + 3 - D) MOD 3
+  PRINT K; F; P(K)
+  M = M + 1
+WEND
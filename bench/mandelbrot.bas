@@ -0,0 +1,19 @@
+FOR Y = -4 TO 4
+  FOR X = -16 TO 5
+    CR = X * 5 / 2 : CI = Y * 4
+    ZR = 0 : ZI = 0 : N = 0 : M = 0
+    WHILE N < 8 AND M <= 1024
+      AR = ZR : IF ZR < 0 THEN AR = -ZR
+      AI = ZI : IF ZI < 0 THEN AI = -ZI
+      RR = AR * AR : II = AI * AI : RI = AR * AI / 8
+      IF (ZR < 0) XOR (ZI < 0) THEN RI = -RI
+      D = RR - II : IF D < 0 THEN T = CR - (-D) / 16 ELSE T = CR + D / 16
+      ZI = RI + CI
+      ZR = T
+      M = RR + II
+      N = N + 1
+    WEND
+    IF N = 8 THEN PRINT "#"; ELSE PRINT ".";
+  NEXT
+  PRINT
+NEXT
@@ -4,489 +4,538 @@
 // License: The Artistic License 2.0, http ://www.perlfoundation.org/artistic_license_2_0
 //-----------------------------------------------------------------------------
 
-#include <cstdint>
+#include "libbf.h"
+#include "perf.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdlib>
 #include <cstring>
+#include <filesystem>
 #include <fstream>
-#include <iomanip>
 #include <iostream>
-#include <sstream>
-#include <stack>
+#include <mutex>
+#include <string>
+#include <thread>
 #include <vector>
 
-void error(const std::string& msg) {
+#include <fcntl.h>
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+// errors of the command line; the machine throws BFError instead
+static void error(const std::string& msg) {
     std::cerr << "Error: " << msg << std::endl;
     exit(EXIT_FAILURE);
 }
 
-void usage_error() {
-    std::cerr << "usage: bf [-t] [-D] [input_file]" << std::endl;
+static void usage_error() {
+    std::cerr << "usage: bf [-t] [-p] [-D] [-w 8|16|32] [-O0|-O1|-O2|-O3] [--enable-pass=pass,...] [--disable-pass=pass,...] "
+              "[--dump-ir=pass] [--pass-stats] [--perf-stats] [--tape-profile=file] [--engine=switch|threaded|jit|tiered] [--guard-tape] [--flush=line|exit] "
+              "[--pre-exec[=steps]] [--cache[=dir]] [--checkpoint=file [--checkpoint-every=seconds]] [--resume=file] [--emit-c] "
+              "[--max-iterations=N] [--max-time=seconds] [--batch [--jobs=N] [--out-dir=dir]] "
+              "[input_file [data_file...]]" << std::endl;
     exit(EXIT_FAILURE);
 }
 
-enum class OpType {
-    Move,
-    Clear, 		// tape[ptr] = 0
-    Increment, 	// tape[ptr] += value
-    Multiply, 	// tape[ptr + value] += tape[ptr] * factor
-    Scan, 		// move pointer until zero is found, value is direction
-    StartLoop,
-    EndLoop,
-    Input,
-    Output,
-};
-
-struct MultiplyTarget {
-    int offset;
-    int factor;
-};
-
-struct Op {
-    OpType type = OpType::Move;
-    int value = 0;
-    std::vector<MultiplyTarget> targets;
-
-    Op(OpType type_, int value_ = 0)
-        : type(type_), value(value_) {}
-
-    std::string to_string() const;
-};
-
-std::string Op::to_string() const {
-    std::ostringstream oss;
-
-    switch (type) {
-    case OpType::Move:
-        oss << "Move" << "(" << value << ")";
-        break;
-    case OpType::Clear:
-        oss << "Clear" << "()";
-        break;
-    case OpType::Increment:
-        oss << "Increment" << "(" << value << ")";
-        break;
-    case OpType::Multiply:
-        oss << "Multiply" << "(";
-        for (const auto& target : targets) {
-            oss << "[" << target.offset << ":" << target.factor << "]";
-        }
-        oss << ")";
-        break;
-    case OpType::Scan:
-        oss << "Scan" << "(" << value << ")";
-        break;
-    case OpType::StartLoop:
-        oss << "StartLoop" << "(" << value << ")";
-        break;
-    case OpType::EndLoop:
-        oss << "EndLoop" << "(" << value << ")";
-        break;
-    case OpType::Input:
-        oss << "Input" << "(" << value << ")";
-        break;
-    case OpType::Output:
-        oss << "Output" << "(" << value << ")";
-        break;
-    default:
-        error("Invalid op");
-    }
-    return oss.str();
-}
-
-class BFVM {
-public:
-    void read_code(std::istream& in);
-    void compile_code();
-    void run();
-
-    void set_trace(bool f = true) {
-        trace = f;
+// $XDG_CACHE_HOME/bf, or else ~/.cache/bf; empty if neither is known
+static std::string default_cache_dir() {
+    const char* xdg = std::getenv("XDG_CACHE_HOME");
+    if (xdg != nullptr && *xdg != '\0') {
+        return std::string(xdg) + "/bf";
+    }
+    const char* home = std::getenv("HOME");
+    if (home != nullptr && *home != '\0') {
+        return std::string(home) + "/.cache/bf";
     }
-    void dump_state() const;
+    return "";
+}
 
-private:
-    std::vector<uint8_t> tape;
-    std::vector<char> code;
-    std::vector<Op> ops;
-    std::vector<int> jumps;
+// step budget of --pre-exec
+static const long default_pre_exec_steps = 10000000;
 
-    int ptr = 0;         // pointer to the tape
-    int pc = 0;          // program counter
+struct Options {
     bool trace = false;
-
-    void translate_ops();
-    void compute_jumps();
+    bool profile = false;
+    bool dump_after = false;
+    bool guard_tape = false;
+    bool emit_c = false;
+    long pre_exec_steps = 0;
+    int cell_width = 8;
+    const char* checkpoint_file = nullptr;
+    double checkpoint_interval = 0;
+    const char* resume_file = nullptr;
+    std::string cache_dir;
+    int opt_level = 3;
+    std::vector<std::pair<std::string, bool>> pass_toggles;    // in command line order
+    const char* dump_ir = nullptr;
+    bool pass_stats = false;
+    bool perf_stats = false;
+    const char* tape_profile = nullptr;     // CSV file of the tape heatmap
+    Engine engine = Engine::Switch;
+    const char* filename = nullptr;
+    uint64_t max_iterations = 0;
+    double max_time = 0;
+    FlushPolicy flush_policy = FlushPolicy::Auto;
+    bool batch = false;
+    unsigned jobs = 0;                  // 0 for one per hardware thread
+    const char* out_dir = nullptr;      // nullptr to frame outputs on stdout
+    std::vector<const char*> batch_inputs;
 };
 
-void BFVM::read_code(std::istream& in) {
-    code.clear();
-    int nesting = 0;
-    int tape_pos = 0;
+// outcome of one input of --batch, handed from its worker to the main thread
+struct BatchResult {
+    bool done = false;
+    std::string error;                  // empty if the run succeeded
+    std::vector<uint8_t> output;        // when framed on stdout
+};
 
-    char ch;
-    while (in >> ch) {
-        // quick filter
-        if (ch == '>' || ch == '<' || ch == '+' || ch == '-' ||
-                ch == '.' || ch == ',' || ch == '[' || ch == ']') {
+// a run stopped by the budget is an error for the command line
+static void check_status(RunStatus status) {
+    if (status == RunStatus::StepLimit) {
+        throw BFError("Loop iteration budget exhausted");
+    }
+    if (status == RunStatus::TimeLimit) {
+        throw BFError("Time budget exhausted");
+    }
+}
 
-            if (ch == '>') {
-                tape_pos++;
-            }
-            else if (ch == '<') {
-                if (--tape_pos < 0) {
-                    error("Tape pointer underflow");
-                }
-            }
-            else if (ch == '[') {
-                nesting++;
-            }
-            else if (ch == ']') {
-                if (--nesting < 0) {
-                    error("Unmatched ']'");
-                }
-            }
-            code.push_back(ch);
+// run one input of --batch on a worker's VM, with the output going to a
+// file of the same name in out_dir, or to memory
+static void run_batch_input(BFMachine& vm, const Options& options, const char* input,
+                            BatchResult& result) {
+    int in_fd = open(input, O_RDONLY | O_BINARY);
+    if (in_fd < 0) {
+        result.error = "Cannot open file: " + std::string(input);
+        return;
+    }
+    int out_fd = -1;
+    if (options.out_dir != nullptr) {
+        std::string name = (std::filesystem::path(options.out_dir) /
+                            std::filesystem::path(input).filename()).string();
+        out_fd = open(name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0666);
+        if (out_fd < 0) {
+            close(in_fd);
+            result.error = "Cannot create file: " + name;
+            return;
         }
+        vm.set_output(out_fd, FlushPolicy::Exit);
+    }
+    else {
+        vm.set_output([&](const uint8_t* data, size_t size) {
+            result.output.insert(result.output.end(), data, data + size);
+        });
     }
+    vm.set_input(in_fd);
 
-    if (nesting != 0) {
-        error("Unmatched '['");
+    try {
+        check_status(vm.run());
+    }
+    catch (const std::exception& e) {
+        result.error = e.what();
+        try {
+            vm.flush_output();          // keep the output up to the error
+        }
+        catch (const std::exception&) {
+        }
     }
-}
 
-void BFVM::compile_code() {
-    translate_ops();
-    compute_jumps();
+    close(in_fd);
+    if (out_fd >= 0) {
+        close(out_fd);
+    }
 }
 
-void BFVM::translate_ops() {
-    ops.clear();
-    size_t in = 0;
-    while (in < code.size()) {
-        if (code[in] == '<' || code[in] == '>') {
-            int movement = 0;
-            for (size_t i = in; i < code.size() && (code[i] == '<' || code[i] == '>'); i++) {
-                if (code[i] == '<') {
-                    movement--;
-                }
-                else {
-                    movement++;
-                }
-                in++;
-            }
-            if (movement != 0) {
-                ops.push_back(Op(OpType::Move, movement));
-            }
-            continue;
-        }
-
-        if (code[in] == '+' || code[in] == '-') {
-            int increment = 0;
-            for (size_t i = in; i < code.size() && (code[i] == '+' || code[i] == '-'); i++) {
-                if (code[i] == '+') {
-                    increment++;
-                }
-                else {
-                    increment--;
-                }
-                in++;
-            }
-            if (increment != 0) {
-                ops.push_back(Op(OpType::Increment, increment));
-            }
-            continue;
+// Run the compiled program once per input file on a pool of threads, each
+// with its own VM and tape. The main thread reports the runs in input order:
+// errors on stderr and, without --out-dir, each output on stdout framed by
+// a line "#bf ok|error <length> <input>". False if any run failed.
+static bool run_batch(const Options& options, const BFMachine& compiled) {
+    size_t count = options.batch_inputs.size();
+    std::vector<BatchResult> results(count);
+    std::atomic<size_t> next(0);
+    std::mutex mutex;
+    std::condition_variable finished;
+
+    auto worker = [&]() {
+        std::unique_ptr<BFMachine> vm = BFMachine::create(options.cell_width);
+        vm->copy_program(compiled);
+        vm->set_engine(options.engine);
+        vm->set_guard_tape(options.guard_tape);
+        vm->set_budget(options.max_iterations, options.max_time);
+
+        for (size_t i = next++; i < count; i = next++) {
+            BatchResult result;
+            run_batch_input(*vm, options, options.batch_inputs[i], result);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            results[i] = std::move(result);
+            results[i].done = true;
+            finished.notify_one();
         }
+    };
 
-        if (in + 2 < code.size() && code[in] == '[' && code[in + 1] == '-' && code[in + 2] == ']') {
-            ops.push_back(Op(OpType::Clear));
-            in += 3;
-            continue;
-        }
+    unsigned jobs = options.jobs;
+    if (jobs == 0) {
+        jobs = std::max(1u, std::thread::hardware_concurrency());
+    }
+    jobs = static_cast<unsigned>(std::min<size_t>(jobs, count));
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < jobs; i++) {
+        threads.emplace_back(worker);
+    }
 
-        // find for scan
-        if (code[in] == '[') {
-            // detects [>] or [<]
-            if (in + 2 < code.size() && (code[in + 1] == '>' || code[in + 1] == '<') && code[in + 2] == ']') {
-                int direction = (code[in + 1] == '>') ? 1 : -1;
-                ops.push_back(Op(OpType::Scan, direction));
-                in += 3;
-                continue;
-            }
+    bool ok = true;
+    for (size_t i = 0; i < count; i++) {
+        BatchResult result;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            finished.wait(lock, [&] { return results[i].done; });
+            result = std::move(results[i]);
         }
 
-        // find for multiply with multiple targets
-        if (code[in] == '[') {
-            size_t scan = in + 1;
-            if (scan < code.size() && code[scan] == '-') {
-                scan++;
-                std::vector<MultiplyTarget> targets;
-                int current_offset = 0;
-
-                // loop[ to capture multiple destinations: >B + >T +
-                while (scan < code.size() &&
-                        (code[scan] == '>' || code[scan] == '<' ||
-                         code[scan] == '+' || code[scan] == '-')) {
-                    // accumulate movements
-                    int move = 0;
-                    while (scan < code.size() &&
-                            (code[scan] == '>' || code[scan] == '<')) {
-                        move += (code[scan] == '>') ? 1 : -1;
-                        scan++;
-                    }
-                    current_offset += move;
-
-                    // accumulate increments for this offset
-                    int factor = 0;
-                    while (scan < code.size() &&
-                            (code[scan] == '+' || code[scan] == '-')) {
-                        factor += (code[scan] == '+') ? 1 : -1;
-                        scan++;
-                    }
-
-                    if (factor != 0)
-                        targets.push_back({current_offset, factor});
-                }
-
-                // verify if the loop is closed and returned to original cell
-                // (current_offset == 0)
-                if (scan < code.size() && code[scan] == ']' &&
-                        current_offset == 0 && !targets.empty()) {
-                    Op multi_op(OpType::Multiply);
-                    multi_op.targets = std::move(targets);
-                    ops.push_back(multi_op);
-                    in = scan + 1;
-                    continue;
-                }
-            }
+        const char* input = options.batch_inputs[i];
+        if (options.out_dir == nullptr) {
+            std::cout << "#bf " << (result.error.empty() ? "ok " : "error ")
+                      << result.output.size() << " " << input << "\n";
+            std::cout.write(reinterpret_cast<const char*>(result.output.data()), result.output.size());
         }
-
-        if (code[in] == '[') {
-            ops.push_back(Op(OpType::StartLoop));
-            in++;
-            continue;
+        if (!result.error.empty()) {
+            ok = false;
+            std::cout.flush();
+            std::cerr << "Error: " << input << ": " << result.error << std::endl;
         }
+    }
+    std::cout.flush();
 
-        if (code[in] == ']') {
-            ops.push_back(Op(OpType::EndLoop));
-            in++;
-            continue;
-        }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    return ok;
+}
 
-        if (code[in] == ',') {
-            ops.push_back(Op(OpType::Input));
-            in++;
-            continue;
+// all the data of a file descriptor
+static std::vector<uint8_t> read_all(int fd) {
+    std::vector<uint8_t> data;
+    uint8_t buffer[65536];
+    for (;;) {
+        auto n = read(fd, buffer, sizeof(buffer));
+        if (n < 0) {
+            throw BFError("Cannot read input: " + std::string(std::strerror(errno)));
         }
-
-        if (code[in] == '.') {
-            ops.push_back(Op(OpType::Output));
-            in++;
-            continue;
+        if (n == 0) {
+            return data;
         }
-
-        error("Invalid command " + std::string(1, code[in]));
+        data.insert(data.end(), buffer, buffer + n);
     }
+}
 
-    compute_jumps();
+// ops executed by the compiled program on the input, in a profiled run of
+// a copy with the output dropped
+static uint64_t count_ops(const BFMachine& compiled, const Options& options, const std::vector<uint8_t>& input) {
+    std::unique_ptr<BFMachine> vm = BFMachine::create(options.cell_width);
+    vm->copy_program(compiled);
+    vm->set_profile();
+    vm->set_input(input.data(), input.size());
+    vm->set_output([](const uint8_t*, size_t) {});
+    check_status(vm->run());
+    return vm->ops_executed();
 }
 
-void BFVM::compute_jumps() {
-    // comppute the jumps
-    jumps.clear();
-    jumps.resize(ops.size(), -1);
-    std::vector<int> stack;
-    stack.reserve(ops.size());
-    for (int i = 0; i < static_cast<int>(ops.size()); i++) {
-        if (ops[i].type == OpType::StartLoop) {
-            stack.push_back(i);
-        }
-        else if (ops[i].type == OpType::EndLoop) {
-            if (stack.empty()) {
-                error("Unmatched ']'");
-            }
-            int open = stack.back();
-            stack.pop_back();
-            jumps[open] = i;
-            jumps[i] = open;
-        }
+static void run_program(BFMachine& vm, const Options& options) {
+    vm.set_output(1, options.flush_policy);
+    vm.set_trace(options.trace);
+    vm.set_profile(options.profile || options.tape_profile != nullptr);
+    vm.set_tape_profile(options.tape_profile != nullptr);
+    vm.set_guard_tape(options.guard_tape);
+    vm.set_pre_exec_steps(options.pre_exec_steps);
+    vm.set_engine(options.engine);
+    vm.set_cache_dir(options.cache_dir);
+    vm.set_opt_level(options.opt_level);
+    for (const auto& toggle : options.pass_toggles) {
+        vm.set_pass(toggle.first, toggle.second);
     }
-    if (!stack.empty()) {
-        error("Unmatched '['");
+    if (options.dump_ir != nullptr) {
+        vm.set_dump_ir(options.dump_ir, &std::cerr);
+    }
+    vm.set_budget(options.max_iterations, options.max_time);
+    if (options.checkpoint_file != nullptr) {
+        vm.set_checkpoint(options.checkpoint_file, options.checkpoint_interval);
     }
-}
 
-void BFVM::dump_state() const {
-    // Find the last non-zero cell
-    int last_nz = 0;
-    for (int i = static_cast<int>(tape.size()); i-- > 0; ) {
-        if (tape[i] != 0) {
-            last_nz = i;
-            break;
+    if (options.filename == nullptr) {
+        vm.read_code(std::cin);
+    }
+    else {
+        vm.read_file(options.filename);
+    }
+
+    vm.compile_code();
+    if (options.pass_stats) {
+        vm.write_pass_stats(std::cerr);
+    }
+    if (options.emit_c) {
+        vm.emit_c(std::cout);
+        return;
+    }
+    if (options.batch) {
+        if (!run_batch(options, vm)) {
+            exit(EXIT_FAILURE);
         }
+        return;
+    }
+    if (options.resume_file != nullptr) {
+        vm.resume(options.resume_file);
     }
 
-    // Ensure we still show the pointer cell even if it's beyond last_nz
-    int last_to_show = std::max(last_nz, ptr);
-    if (last_to_show >= static_cast<int>(tape.size())) {
-        last_to_show = static_cast<int>(tape.size()) - 1;
+    // --perf-stats reads the input up front, to replay it when counting
+    // the ops; the counters only cover the run
+    std::vector<uint8_t> input;
+    std::unique_ptr<PerfCounters> counters;
+    if (options.perf_stats) {
+        input = read_all(0);
+        vm.set_input(input.data(), input.size());
+        counters.reset(new PerfCounters());
+        counters->start();
     }
 
-    std::cout << "Tape:";
-    for (int i = 0; i <= last_to_show; ++i) {
-        std::cout << std::setw(3) << static_cast<int>(tape[i]) << ' ';
+    RunStatus status = vm.run();
+    if (counters) {
+        counters->stop();
     }
-    std::cout << "\n     ";
-    if (ptr > 0) {
-        std::cout << std::string(ptr * 4, ' ');
+    check_status(status);
+
+    if (options.profile) {
+        vm.write_profile(std::cerr);
+    }
+    if (options.tape_profile != nullptr) {
+        std::ofstream csv(options.tape_profile);
+        vm.write_tape_heatmap(csv);
+        if (!csv.flush()) {
+            throw BFError("Cannot create file: " + std::string(options.tape_profile));
+        }
+        vm.write_tape_profile(std::cerr);
+    }
+    if (counters) {
+        vm.flush_output();
+        bool profiled = options.profile || options.tape_profile != nullptr;
+        counters->write(std::cerr, profiled ? vm.ops_executed() : count_ops(vm, options, input));
+    }
+    if (options.dump_after) {
+        vm.dump_state(std::cout);
     }
-    std::cout << "^^^" << " (ptr=" << ptr << ")\n\n";
 }
 
-void BFVM::run() {
-    pc = ptr = 0;
-    tape.clear();
-    tape.push_back(0); // initialize tape with one cell
+int main(int argc, char* argv[]) {
+    Options options;
+    std::vector<const char*> files;
 
-    while (pc < static_cast<int>(ops.size())) {
-        if (trace) {
-            std::cout << "PC=" << pc << " instr=" << ops[pc].to_string() << "\n";
-        }
+    std::ios::sync_with_stdio(false);
 
-        switch (ops[pc].type) {
-        case OpType::Move:
-            ptr += ops[pc].value;
-            if (ptr < 0) {
-                error("Tape pointer underflow");
-            }
-            else if (ptr >= static_cast<int>(tape.size())) {
-                tape.resize(ptr + 1, 0);
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        if (std::strcmp(arg, "-t") == 0) {
+            options.trace = true;
+        }
+        else if (std::strcmp(arg, "-p") == 0) {
+            options.profile = true;
+        }
+        else if (std::strcmp(arg, "-D") == 0) {
+            options.dump_after = true;
+        }
+        else if (std::strcmp(arg, "-w") == 0) {
+            if (i + 1 >= argc) {
+                usage_error();
             }
-            break;
-
-        case OpType::Clear:
-            tape[ptr] = 0;
-            break;
-
-        case OpType::Increment:
-            tape[ptr] += static_cast<uint8_t>(ops[pc].value);
-            break;
-
-        case OpType::Multiply: {
-            uint8_t origin_val = tape[ptr];
-            if (origin_val == 0) {
-                break;    // nothing to do
+            std::string width = argv[++i];
+            if (width == "8" || width == "16" || width == "32") {
+                options.cell_width = std::stoi(width);
             }
-
-            for (const auto& target : ops[pc].targets) {
-                int target_ptr = ptr + target.offset;
-                if (target_ptr < 0) {
-                    error("Tape pointer underflow");
-                }
-                if (target_ptr >= static_cast<int>(tape.size())) {
-                    tape.resize(target_ptr + 1, 0);
-                }
-
-                tape[target_ptr] = static_cast<uint8_t>(tape[target_ptr] +
-                                                        (origin_val * target.factor));
+            else {
+                error("Invalid cell width: " + width);
             }
-
-            tape[ptr] = 0;
-            break;
         }
-        case OpType::Scan: {
-            int direction = ops[pc].value;
-            while (ptr >= 0 && ptr < static_cast<int>(tape.size()) && tape[ptr] != 0) {
-                ptr += direction;
+        else if (arg[0] == '-' && arg[1] == 'O' && arg[2] >= '0' && arg[2] <= '3' && arg[3] == '\0') {
+            options.opt_level = arg[2] - '0';
+        }
+        else if (std::strncmp(arg, "--enable-pass=", 14) == 0 || std::strncmp(arg, "--disable-pass=", 15) == 0) {
+            bool enable = (arg[2] == 'e');
+            std::string names = std::strchr(arg, '=') + 1;
+            size_t pos = 0;
+            do {
+                size_t comma = std::min(names.find(',', pos), names.size());
+                options.pass_toggles.push_back({ names.substr(pos, comma - pos), enable });
+                pos = comma + 1;
+            } while (pos <= names.size());
+        }
+        else if (std::strncmp(arg, "--dump-ir=", 10) == 0 && arg[10] != '\0') {
+            options.dump_ir = arg + 10;
+        }
+        else if (std::strcmp(arg, "--pass-stats") == 0) {
+            options.pass_stats = true;
+        }
+        else if (std::strcmp(arg, "--perf-stats") == 0) {
+            options.perf_stats = true;
+        }
+        else if (std::strncmp(arg, "--tape-profile=", 15) == 0 && arg[15] != '\0') {
+            options.tape_profile = arg + 15;
+        }
+        else if (std::strcmp(arg, "--guard-tape") == 0) {
+            options.guard_tape = true;
+        }
+        else if (std::strcmp(arg, "--emit-c") == 0) {
+            options.emit_c = true;
+        }
+        else if (std::strcmp(arg, "--pre-exec") == 0) {
+            options.pre_exec_steps = default_pre_exec_steps;
+        }
+        else if (std::strncmp(arg, "--pre-exec=", 11) == 0) {
+            char* end = nullptr;
+            long steps = std::strtol(arg + 11, &end, 10);
+            if (end == arg + 11 || *end != '\0' || steps < 0) {
+                error("Invalid step budget: " + std::string(arg + 11));
             }
-
-            // Se o ponteiro sair dos limites, expandimos a tape conforme necessário
-            if (ptr < 0) {
-                error("Tape pointer underflow");
+            options.pre_exec_steps = steps;
+        }
+        else if (std::strncmp(arg, "--checkpoint=", 13) == 0 && arg[13] != '\0') {
+            options.checkpoint_file = arg + 13;
+        }
+        else if (std::strncmp(arg, "--checkpoint-every=", 19) == 0) {
+            char* end = nullptr;
+            double seconds = std::strtod(arg + 19, &end);
+            if (end == arg + 19 || *end != '\0' || !(seconds > 0)) {
+                error("Invalid checkpoint interval: " + std::string(arg + 19));
             }
-            else if (ptr >= static_cast<int>(tape.size())) {
-                tape.resize(ptr + 1, 0);
+            options.checkpoint_interval = seconds;
+        }
+        else if (std::strncmp(arg, "--resume=", 9) == 0 && arg[9] != '\0') {
+            options.resume_file = arg + 9;
+        }
+        else if (std::strcmp(arg, "--cache") == 0) {
+            options.cache_dir = default_cache_dir();
+        }
+        else if (std::strncmp(arg, "--cache=", 8) == 0 && arg[8] != '\0') {
+            options.cache_dir = arg + 8;
+        }
+        else if (std::strncmp(arg, "--max-iterations=", 17) == 0) {
+            char* end = nullptr;
+            unsigned long long count = std::strtoull(arg + 17, &end, 10);
+            if (end == arg + 17 || *end != '\0' || count == 0 || arg[17] == '-') {
+                error("Invalid iteration budget: " + std::string(arg + 17));
             }
-            break;
-        }
-        case OpType::StartLoop:
-            if (tape[ptr] == 0) {
-                pc = jumps[pc];
-                if (pc < 0) {
-                    error("Invalid jump");
-                }
-                continue;      // do not pc++ below
+            options.max_iterations = count;
+        }
+        else if (std::strncmp(arg, "--max-time=", 11) == 0) {
+            char* end = nullptr;
+            double seconds = std::strtod(arg + 11, &end);
+            if (end == arg + 11 || *end != '\0' || !(seconds > 0)) {
+                error("Invalid time budget: " + std::string(arg + 11));
             }
-            break;
-
-        case OpType::EndLoop:
-            if (tape[ptr] != 0) {
-                pc = jumps[pc];
-                if (pc < 0) {
-                    error("Invalid jump");
-                }
-                continue;      // do not pc++ below
+            options.max_time = seconds;
+        }
+        else if (std::strcmp(arg, "--batch") == 0) {
+            options.batch = true;
+        }
+        else if (std::strncmp(arg, "--jobs=", 7) == 0) {
+            char* end = nullptr;
+            long jobs = std::strtol(arg + 7, &end, 10);
+            if (end == arg + 7 || *end != '\0' || jobs < 1 || jobs > 4096) {
+                error("Invalid job count: " + std::string(arg + 7));
             }
-            break;
-
-        case OpType::Input:
-            tape[ptr] = static_cast<uint8_t>(std::cin.get());
-            break;
-
-        case OpType::Output:
-            std::cout.put(static_cast<char>(tape[ptr]));
-            break;
-
-        default:
-            error("Invalid op");
+            options.jobs = static_cast<unsigned>(jobs);
         }
-
-        if (trace) {
-            dump_state();
+        else if (std::strncmp(arg, "--out-dir=", 10) == 0 && arg[10] != '\0') {
+            options.out_dir = arg + 10;
         }
-
-        pc++;
-    }
-}
-
-int main(int argc, char* argv[]) {
-    BFVM vm;
-    bool dump_after = false;
-    const char* filename = nullptr;
-
-    for (int i = 1; i < argc; ++i) {
-        const char* arg = argv[i];
-        if (std::strcmp(arg, "-t") == 0) {
-            vm.set_trace(true);
+        else if (std::strncmp(arg, "--flush=", 8) == 0) {
+            std::string name = arg + 8;
+            if (name == "line") {
+                options.flush_policy = FlushPolicy::Line;
+            }
+            else if (name == "exit") {
+                options.flush_policy = FlushPolicy::Exit;
+            }
+            else {
+                error("Unknown flush policy: " + name);
+            }
         }
-        else if (std::strcmp(arg, "-D") == 0) {
-            dump_after = true;
+        else if (std::strncmp(arg, "--engine=", 9) == 0) {
+            std::string name = arg + 9;
+            if (name == "switch") {
+                options.engine = Engine::Switch;
+            }
+            else if (name == "threaded") {
+                options.engine = Engine::Threaded;
+            }
+            else if (name == "jit") {
+                options.engine = Engine::Jit;
+            }
+            else if (name == "tiered") {
+                options.engine = Engine::Tiered;
+            }
+            else {
+                error("Unknown engine: " + name);
+            }
         }
         else if (arg[0] == '-') {
             usage_error();
         }
-        else if (filename == nullptr) {
-            filename = arg;
-        }
         else {
-            usage_error();
+            files.push_back(arg);
         }
     }
 
-    if (filename == nullptr) {
-        vm.read_code(std::cin);
+    // the program, then with --batch the input files
+    if (!files.empty()) {
+        options.filename = files[0];
+        options.batch_inputs.assign(files.begin() + 1, files.end());
     }
-    else {
-        std::ifstream file(filename, std::ios::binary);
-        if (!file) {
-            error("Cannot open file: " + std::string(filename));
-        }
-        vm.read_code(file);
+    if (!options.batch_inputs.empty() && !options.batch) {
+        usage_error();
     }
 
-    vm.compile_code();
-    vm.run();
+    if (options.checkpoint_interval > 0 && options.checkpoint_file == nullptr) {
+        error("--checkpoint-every needs --checkpoint");
+    }
+    if ((options.jobs > 0 || options.out_dir != nullptr) && !options.batch) {
+        error("--jobs and --out-dir need --batch");
+    }
+    if (options.perf_stats && options.resume_file != nullptr) {
+        error("--perf-stats cannot be used with --resume");
+    }
+    if (options.batch) {
+        if (options.filename == nullptr) {
+            usage_error();
+        }
+        if (options.trace || options.profile || options.dump_after || options.emit_c || options.perf_stats ||
+                options.tape_profile != nullptr || options.checkpoint_file != nullptr || options.resume_file != nullptr) {
+            error("--batch cannot be used with -t, -p, -D, --emit-c, --perf-stats, --tape-profile, --checkpoint or --resume");
+        }
+    }
 
-    if (dump_after) {
-        vm.dump_state();
+    // errors of the machine come after the output written before them
+    std::unique_ptr<BFMachine> vm;
+    try {
+        vm = BFMachine::create(options.cell_width);
+        run_program(*vm, options);
+    }
+    catch (const BFError& e) {
+        if (vm) {
+            try {
+                vm->flush_output();
+            }
+            catch (const BFError&) {
+            }
+        }
+        std::cout.flush();
+        error(e.what());
     }
 
     return 0;
@@ -0,0 +1,163 @@
+//-----------------------------------------------------------------------------
+// Brainfuck interpreter
+// Copyright (c) Paulo Custodio 2026
+// License: The Artistic License 2.0, http ://www.perlfoundation.org/artistic_license_2_0
+//-----------------------------------------------------------------------------
+
+#include "perf.h"
+#include <chrono>
+#include <ctime>
+#include <iomanip>
+
+#if defined(__linux__)
+#define BF_HAVE_PERF_EVENTS 1
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+static double wall_clock() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static double thread_cpu_clock() {
+#if defined(CLOCK_THREAD_CPUTIME_ID)
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0) {
+        return static_cast<double>(ts.tv_sec) + static_cast<double>(ts.tv_nsec) * 1e-9;
+    }
+#endif
+    return static_cast<double>(std::clock()) / CLOCKS_PER_SEC;
+}
+
+#ifdef BF_HAVE_PERF_EVENTS
+// a counter of this thread in user mode, disabled until start(); -1 if the
+// kernel refuses it
+static int open_counter(uint32_t type, uint64_t config) {
+    struct perf_event_attr attr = {};
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+}
+#endif
+
+PerfCounters::PerfCounters() {
+    counters.resize(5);
+    counters[0].name = "cycles";
+    counters[1].name = "instructions";
+    counters[2].name = "branch-misses";
+    counters[3].name = "L1d-read-misses";
+    counters[4].name = "task-clock";
+#ifdef BF_HAVE_PERF_EVENTS
+    counters[0].fd = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    counters[1].fd = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    counters[2].fd = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+    counters[3].fd = open_counter(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+                                  (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+    counters[4].fd = open_counter(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK);
+#endif
+}
+
+PerfCounters::~PerfCounters() {
+#ifdef BF_HAVE_PERF_EVENTS
+    for (auto& counter : counters) {
+        if (counter.fd >= 0) {
+            close(counter.fd);
+        }
+    }
+#endif
+}
+
+void PerfCounters::start() {
+#ifdef BF_HAVE_PERF_EVENTS
+    for (auto& counter : counters) {
+        if (counter.fd >= 0) {
+            ioctl(counter.fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(counter.fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+#endif
+    wall_start = wall_clock();
+    cpu_start = thread_cpu_clock();
+}
+
+void PerfCounters::stop() {
+    cpu_seconds = thread_cpu_clock() - cpu_start;
+    wall_seconds = wall_clock() - wall_start;
+#ifdef BF_HAVE_PERF_EVENTS
+    for (auto& counter : counters) {
+        if (counter.fd < 0) {
+            continue;
+        }
+        ioctl(counter.fd, PERF_EVENT_IOC_DISABLE, 0);
+        uint64_t data[3];   // value, time enabled, time running
+        if (read(counter.fd, data, sizeof(data)) != static_cast<ssize_t>(sizeof(data)) || data[2] == 0) {
+            close(counter.fd);
+            counter.fd = -1;
+            continue;
+        }
+        counter.value = data[0];
+        if (data[2] < data[1]) {
+            counter.value = static_cast<uint64_t>(static_cast<double>(data[0]) * data[1] / data[2]);
+            counter.scaled = true;
+        }
+    }
+#endif
+}
+
+const PerfCounters::Counter* PerfCounters::find(const std::string& name) const {
+    for (const auto& counter : counters) {
+        if (counter.name == name && counter.fd >= 0) {
+            return &counter;
+        }
+    }
+    return nullptr;
+}
+
+void PerfCounters::write(std::ostream& out, uint64_t ops) const {
+    out << "Perf stats:\n"
+        << "  " << std::left << std::setw(18) << "ops executed" << std::right << std::setw(16) << ops << "\n";
+    for (const auto& counter : counters) {
+        out << "  " << std::left << std::setw(18) << counter.name << std::right;
+        if (counter.fd < 0) {
+            out << std::setw(16) << "not counted" << "\n";
+        }
+        else if (counter.name == "task-clock") {
+            out << std::fixed << std::setprecision(3) << std::setw(16) << counter.value / 1e6 << " ms\n";
+        }
+        else {
+            out << std::setw(16) << counter.value << (counter.scaled ? " (scaled)" : "") << "\n";
+        }
+    }
+
+    // the task clock, or else the thread CPU time
+    const Counter* clock = find("task-clock");
+    double seconds = clock != nullptr ? clock->value / 1e9 : cpu_seconds;
+    out << std::fixed << std::setprecision(3)
+        << "  " << std::left << std::setw(18) << "cpu time" << std::right << std::setw(16) << seconds * 1e3 << " ms"
+        << (clock != nullptr ? "" : " (thread CPU clock)") << "\n"
+        << "  " << std::left << std::setw(18) << "wall time" << std::right << std::setw(16) << wall_seconds * 1e3 << " ms\n";
+
+    const Counter* cycles = find("cycles");
+    const Counter* instructions = find("instructions");
+    if (cycles != nullptr && cycles->value > 0) {
+        out << "  " << std::left << std::setw(18) << "ops/cycle" << std::right
+            << std::setw(16) << static_cast<double>(ops) / cycles->value << "\n";
+        if (instructions != nullptr) {
+            out << "  " << std::left << std::setw(18) << "instructions/cycle" << std::right
+                << std::setw(16) << static_cast<double>(instructions->value) / cycles->value << "\n";
+        }
+    }
+    if (seconds > 0) {
+        out << "  " << std::left << std::setw(18) << "ops/second" << std::right
+            << std::setprecision(0) << std::setw(16) << ops / seconds << "\n";
+    }
+    out << std::defaultfloat << std::setprecision(6) << std::flush;
+}
@@ -0,0 +1,49 @@
+//-----------------------------------------------------------------------------
+// Brainfuck interpreter
+// Copyright (c) Paulo Custodio 2026
+// License: The Artistic License 2.0, http ://www.perlfoundation.org/artistic_license_2_0
+//-----------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Performance counters of the calling thread between start() and stop():
+// cycles, instructions, branch misses and L1 data cache read misses, read
+// with Linux perf_event_open(2) in user mode. Counters the kernel or the
+// CPU refuse are reported as not counted; the task clock is a software
+// counter, and without perf events at all the thread CPU time stands in
+// for it.
+class PerfCounters {
+public:
+    PerfCounters();
+    ~PerfCounters();
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    void start();
+    void stop();
+
+    // the counters, with ops per cycle and per second for the given count of
+    // ops executed
+    void write(std::ostream& out, uint64_t ops) const;
+
+private:
+    struct Counter {
+        std::string name;
+        int fd = -1;            // -1 if the counter could not be opened
+        uint64_t value = 0;
+        bool scaled = false;    // multiplexed, and extrapolated to the run
+    };
+    std::vector<Counter> counters;
+    double cpu_seconds = 0;     // thread CPU time, when no task clock
+    double wall_seconds = 0;
+    double cpu_start = 0;
+    double wall_start = 0;
+
+    const Counter* find(const std::string& name) const;
+};
@@ -0,0 +1,5384 @@
+//-----------------------------------------------------------------------------
+// Brainfuck virtual machine library
+// Copyright (c) Paulo Custodio 2026
+// License: The Artistic License 2.0, http ://www.perlfoundation.org/artistic_license_2_0
+//-----------------------------------------------------------------------------
+
+#include "libbf.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <stack>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// native code generation needs an x86-64 System V target with mmap
+#if defined(__x86_64__) && !defined(_WIN32)
+#define BF_HAVE_JIT 1
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// guard-page tapes need mmap/mprotect and a SIGSEGV handler
+#if !defined(_WIN32)
+#define BF_HAVE_GUARD_TAPE 1
+#include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// program files are mapped in memory
+#if !defined(_WIN32)
+#define BF_HAVE_MMAP_LOADER 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// checkpoints requested by SIGUSR1
+#if !defined(_WIN32)
+#define BF_HAVE_CHECKPOINT_SIGNALS 1
+#include <signal.h>
+#endif
+
+// errors raised where an exception cannot unwind, in the helpers called
+// from JIT code and in the guard page fault handler, go back by longjmp to
+// run_escapable() and are thrown from there
+#if defined(BF_HAVE_JIT) || defined(BF_HAVE_GUARD_TAPE)
+#define BF_HAVE_ESCAPE 1
+#include <setjmp.h>
+#endif
+
+// raw file descriptor I/O
+#include <fcntl.h>
+#if defined(_WIN32)
+#include <io.h>
+#include <process.h>
+#define getpid _getpid
+#define read _read
+#define write _write
+#define isatty _isatty
+#else
+#include <unistd.h>
+#endif
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+// errors are thrown to the caller of the library
+static void error(const std::string& msg) {
+    throw BFError(msg);
+}
+
+class OutputBuffer;
+
+// Program input, read in large blocks from a file descriptor or a callback,
+// or in place from a buffer of the caller
+class InputBuffer {
+public:
+    int get() {
+        if (pos == len && !fill()) {
+            return EOF;
+        }
+        return data[pos++];
+    }
+    uint64_t offset() const {       // bytes consumed so far
+        return filled - (len - pos);
+    }
+    void skip(uint64_t count);
+    void reset(int fd_);
+    void reset(const uint8_t* memory, size_t size);
+    void reset(ReadCallback callback);
+    void set_prompt(OutputBuffer* output) {
+        prompt = output;
+    }
+
+private:
+    static const size_t buffer_size = 64 * 1024;
+    int fd = 0;
+    ReadCallback read_callback;     // used instead of fd if set
+    std::vector<uint8_t> buffer;
+    const uint8_t* data = nullptr;  // buffer, or the memory of the caller
+    size_t pos = 0;
+    size_t len = 0;
+    uint64_t filled = 0;            // bytes read from the source
+    bool eof = false;
+    OutputBuffer* prompt = nullptr; // flushed before an interactive read
+
+    bool fill();
+};
+
+// Program output, written in large blocks to a file descriptor or a
+// callback, or in place to a buffer of the caller
+class OutputBuffer {
+public:
+    void put(uint8_t c) {
+        if (len == capacity) {
+            make_room();
+        }
+        data[len++] = c;
+        if (line_flush && c == '\n') {
+            flush();
+        }
+    }
+    void put(const uint8_t* bytes, size_t size);
+    void flush();
+    void set_flush_policy(FlushPolicy policy);
+    bool interactive() const {
+        return line_flush;
+    }
+    uint64_t offset() const {       // bytes written so far
+        return flushed + len;
+    }
+    void resume_at(uint64_t offset);
+    void reset(int fd_, FlushPolicy policy);
+    void reset(uint8_t* memory, size_t size);
+    void reset(WriteCallback callback);
+
+private:
+    static const size_t buffer_size = 64 * 1024;
+    int fd = 1;
+    WriteCallback write_callback;   // used instead of fd if set
+    std::vector<uint8_t> buffer;
+    uint8_t* data = nullptr;        // buffer, or the memory of the caller
+    size_t capacity = 0;
+    size_t len = 0;
+    uint64_t flushed = 0;           // bytes passed to write_all
+    bool line_flush = false;
+    bool in_place = false;          // data is the memory of the caller
+
+    void make_room();
+    void write_all(const uint8_t* bytes, size_t size);
+};
+
+bool InputBuffer::fill() {
+    if (eof) {
+        return false;
+    }
+
+    // show any prompt before blocking on an interactive read
+    if (prompt != nullptr && prompt->interactive()) {
+        prompt->flush();
+    }
+
+    if (buffer.empty()) {
+        buffer.resize(buffer_size);
+        data = buffer.data();
+    }
+    pos = len = 0;
+    if (read_callback) {
+        len = read_callback(buffer.data(), buffer_size);
+        filled += len;
+        eof = (len == 0);
+        return !eof;
+    }
+    for (;;) {
+        int n = static_cast<int>(read(fd, buffer.data(), buffer_size));
+        if (n > 0) {
+            len = static_cast<size_t>(n);
+            filled += len;
+            return true;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        eof = true;     // end of file or read error
+        return false;
+    }
+}
+
+void InputBuffer::reset(int fd_) {
+    fd = fd_;
+    read_callback = nullptr;
+    data = buffer.data();
+    pos = len = 0;
+    filled = 0;
+    eof = false;
+}
+
+// the whole input is already there: no copy, no reads
+void InputBuffer::reset(const uint8_t* memory, size_t size) {
+    reset(-1);
+    data = memory;
+    len = size;
+    filled = size;
+    eof = true;
+}
+
+void InputBuffer::reset(ReadCallback callback) {
+    reset(-1);
+    read_callback = std::move(callback);
+}
+
+void InputBuffer::skip(uint64_t count) {
+    while (count > 0) {
+        if (pos == len && !fill()) {
+            error("Input ends before the checkpoint");
+        }
+        size_t n = static_cast<size_t>(std::min<uint64_t>(count, len - pos));
+        pos += n;
+        count -= n;
+    }
+}
+
+// blocks larger than the buffer are written directly
+void OutputBuffer::put(const uint8_t* bytes, size_t size) {
+    if (len + size <= capacity) {
+        std::memcpy(data + len, bytes, size);
+        len += size;
+    }
+    else if (in_place) {
+        error("Output buffer full");
+    }
+    else {
+        flush();
+        write_all(bytes, size);
+    }
+    if (line_flush && std::memchr(bytes, '\n', size) != nullptr) {
+        flush();
+    }
+}
+
+void OutputBuffer::make_room() {
+    if (in_place) {
+        error("Output buffer full");
+    }
+    flush();
+}
+
+// output in place is already where it belongs
+void OutputBuffer::flush() {
+    if (in_place) {
+        return;
+    }
+    size_t size = len;
+    len = 0;    // drop the output on error, do not retry on the next flush
+    write_all(data, size);
+}
+
+void OutputBuffer::write_all(const uint8_t* bytes, size_t size) {
+    flushed += size;
+    if (write_callback) {
+        write_callback(bytes, size);
+        return;
+    }
+    size_t done = 0;
+    while (done < size) {
+        int n = static_cast<int>(::write(fd, bytes + done, static_cast<unsigned>(size - done)));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            error("Cannot write output");
+        }
+        done += static_cast<size_t>(n);
+    }
+}
+
+// continue the output of a run resumed from a checkpoint: a regular file
+// that holds more than the output up to the checkpoint is cut back to it
+void OutputBuffer::resume_at(uint64_t offset) {
+    flushed = offset;
+#if !defined(_WIN32)
+    struct stat st;
+    if (fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+            static_cast<uint64_t>(st.st_size) >= offset) {
+        if (ftruncate(fd, static_cast<off_t>(offset)) != 0 ||
+                lseek(fd, static_cast<off_t>(offset), SEEK_SET) < 0) {
+            error("Cannot position output at the checkpoint");
+        }
+    }
+#endif
+}
+
+void OutputBuffer::reset(int fd_, FlushPolicy policy) {
+    fd = fd_;
+    write_callback = nullptr;
+    buffer.resize(buffer_size);
+    data = buffer.data();
+    capacity = buffer_size;
+    len = 0;
+    flushed = 0;
+    in_place = false;
+    set_flush_policy(policy);
+}
+
+void OutputBuffer::reset(uint8_t* memory, size_t size) {
+    reset(-1, FlushPolicy::Exit);
+    data = memory;
+    capacity = size;
+    in_place = true;
+}
+
+void OutputBuffer::reset(WriteCallback callback) {
+    reset(-1, FlushPolicy::Exit);
+    write_callback = std::move(callback);
+}
+
+void OutputBuffer::set_flush_policy(FlushPolicy policy) {
+    if (policy == FlushPolicy::Auto) {
+        policy = (fd >= 0 && isatty(fd)) ? FlushPolicy::Line : FlushPolicy::Exit;
+    }
+    line_flush = (policy == FlushPolicy::Line);
+}
+
+// computed-goto dispatch needs the GNU labels-as-values extension
+#if defined(__GNUC__)
+#define BF_HAVE_THREADED 1
+#endif
+
+// ops address the cell at ptr + offset; the pointer itself only moves on
+// Move and Scan, which the offsets pass leaves at loop boundaries
+enum class OpType : uint8_t {
+    Move,
+    Clear, 		// tape[ptr + offset] = 0
+    Set, 		// tape[ptr + offset] = value
+    Increment, 	// tape[ptr + offset] += value
+    Multiply, 	// tape[ptr + offset + target] += tape[ptr + offset] * factor
+    Scan, 		// move pointer until zero is found, value is the signed stride
+    StartLoop,
+    EndLoop,
+    Input,
+    Output,
+    If,         // skip the next value ops if tape[ptr + offset] is zero: a
+                // loop that runs at most once
+};
+
+// the last OpType, for range checks of stored ops; keep it the last one
+static const OpType last_op_type = OpType::If;
+
+struct MultiplyTarget {
+    int offset;
+    int factor;
+};
+
+struct Op {
+    OpType type = OpType::Move;
+    int value = 0;
+    int offset = 0;     // cell addressed relative to ptr
+    int source = 0;     // index in code of the first command of the op
+    std::vector<MultiplyTarget> targets;
+
+    Op(OpType type_, int value_ = 0, int offset_ = 0)
+        : type(type_), value(value_), offset(offset_) {}
+
+    std::string to_string() const;
+};
+
+// Compact form of the ops run by the switch and threaded loops: 8 bytes per
+// instruction with the jump targets inline. The targets of a Multiply live
+// in one side table, as a header entry { offset, count } followed by count
+// entries { offset from ptr, factor }.
+template<typename Cell>
+struct Instr {
+    OpType type;
+    Cell value;         // Set, Increment: the value modulo the cell size,
+                        // If: the cell offset
+    int32_t arg;        // Move: delta, Scan: stride, StartLoop/EndLoop/If: jump
+                        // target, Multiply: index in the side table,
+                        // otherwise the cell offset
+};
+
+// cell offset of an If instruction
+template<typename Cell>
+static int if_offset(const Instr<Cell>& instr) {
+    return static_cast<typename std::make_signed<Cell>::type>(instr.value);
+}
+
+static_assert(sizeof(Instr<uint8_t>) == 8, "Instr should pack into 8 bytes");
+
+std::string Op::to_string() const {
+    std::ostringstream oss;
+
+    switch (type) {
+    case OpType::Move:
+        oss << "Move" << "(" << value << ")";
+        break;
+    case OpType::Clear:
+        oss << "Clear" << "()";
+        break;
+    case OpType::Set:
+        oss << "Set" << "(" << value << ")";
+        break;
+    case OpType::Increment:
+        oss << "Increment" << "(" << value << ")";
+        break;
+    case OpType::Multiply:
+        oss << "Multiply" << "(";
+        for (const auto& target : targets) {
+            oss << "[" << target.offset << ":" << target.factor << "]";
+        }
+        oss << ")";
+        break;
+    case OpType::Scan:
+        oss << "Scan" << "(" << value << ")";
+        break;
+    case OpType::StartLoop:
+        oss << "StartLoop" << "(" << value << ")";
+        break;
+    case OpType::EndLoop:
+        oss << "EndLoop" << "(" << value << ")";
+        break;
+    case OpType::Input:
+        oss << "Input" << "(" << value << ")";
+        break;
+    case OpType::Output:
+        oss << "Output" << "(" << value << ")";
+        break;
+    case OpType::If:
+        oss << "If" << "(" << value << ")";
+        break;
+    default:
+        error("Invalid op");
+    }
+    if (offset != 0) {
+        oss << "@" << offset;
+    }
+    return oss.str();
+}
+
+// Tape cells. By default a heap buffer that grows to the right on demand.
+// A guarded tape is instead a fixed mmap reservation bracketed by PROT_NONE
+// guard pages: the kernel commits pages lazily as they are touched, and an
+// access past either end faults and is reported by a SIGSEGV handler, so
+// the run loops need no bounds checks on accesses. They still test the sign
+// of the pointer after a move, which may pass below cell 0 between two
+// accesses.
+template<typename Cell>
+class Tape {
+public:
+    Tape() = default;
+    Tape(const Tape&) = delete;
+    Tape& operator=(const Tape&) = delete;
+    ~Tape();
+
+    void reset();       // growable tape with one cell
+    bool reset_guarded(size_t guard_before, size_t guard_after);
+
+    Cell& operator[](size_t i) {
+        return base[i];
+    }
+    Cell operator[](size_t i) const {
+        return base[i];
+    }
+    Cell* data() {
+        return base;
+    }
+    size_t size() const {
+        return length;
+    }
+    void resize(size_t n);
+    size_t used_size() const;   // cells that may hold non-zero values
+    bool guarded() const {
+        return mapping != nullptr;
+    }
+
+private:
+    std::vector<Cell> heap;
+    Cell* base = nullptr;
+    size_t length = 0;
+    void* mapping = nullptr;
+    size_t mapping_size = 0;
+
+    void unmap();
+};
+
+template<typename Cell> class BFVM;
+
+// machine state shared with the JIT code, addressed through r15
+struct JitState {
+    uint8_t* base;      // [r15+0]  tape data
+    int64_t size;       // [r15+8]  tape size
+    int64_t ptr;        // [r15+16] pointer to the tape
+    BFVM<uint8_t>* vm;  // [r15+24]
+    int64_t countdown;  // [r15+32] loop iterations until the next poll
+};
+
+template<typename Cell>
+class BFVM : public BFMachine {
+public:
+    BFVM();
+
+    void read_code(std::istream& in) override;
+    void read_file(const char* filename) override;
+    void load_code(const char* text, size_t size) override {
+        load_source(text, size);
+    }
+
+    void set_profile(bool f = true) override {
+        profile = f;
+    }
+    void set_tape_profile(bool f = true) override {
+        tape_profile = f;
+    }
+    void set_pre_exec_steps(long steps) override {
+        pre_exec_steps = steps;
+    }
+    void set_cache_dir(const std::string& dir) override {
+        cache_dir = dir;
+    }
+    void set_opt_level(int level) override;
+    void set_pass(const std::string& name, bool enabled) override;
+    void set_dump_ir(const std::string& pass, std::ostream* out) override;
+
+    void compile_code() override;
+    void copy_program(const BFMachine& compiled) override;
+
+    void set_trace(bool f = true) override {
+        trace = f;
+    }
+    void set_engine(Engine e) override {
+        engine = e;
+    }
+    void set_guard_tape(bool f = true) override {
+        guard_tape = f;
+    }
+    void set_checkpoint(const std::string& filename, double interval) override {
+        checkpoint_file = filename;
+        checkpoint_interval = interval;
+    }
+    void set_budget(uint64_t loop_iterations, double seconds) override {
+        step_budget = loop_iterations;
+        time_budget = seconds;
+    }
+
+    void set_input(int fd) override {
+        program_input.reset(fd);
+    }
+    void set_input(const uint8_t* data, size_t size) override {
+        program_input.reset(data, size);
+    }
+    void set_input(ReadCallback read) override {
+        program_input.reset(std::move(read));
+    }
+    void set_output(int fd, FlushPolicy policy = FlushPolicy::Auto) override {
+        program_output.reset(fd, policy);
+    }
+    void set_output(uint8_t* data, size_t capacity) override {
+        program_output.reset(data, capacity);
+    }
+    void set_output(WriteCallback write) override {
+        program_output.reset(std::move(write));
+    }
+    uint64_t output_size() const override {
+        return program_output.offset();
+    }
+    void flush_output() override {
+        program_output.flush();
+    }
+
+    void resume(const std::string& filename) override;
+    RunStatus run() override;
+
+    void dump_state(std::ostream& out) const override;
+    void write_profile(std::ostream& out) const override;
+    uint64_t ops_executed() const override;
+    void write_tape_profile(std::ostream& out) const override;
+    void write_tape_heatmap(std::ostream& out) const override;
+    void emit_c(std::ostream& out) const override;
+    void write_pass_stats(std::ostream& out) const override;
+
+private:
+    InputBuffer program_input;
+    OutputBuffer program_output;
+    Tape<Cell> tape;
+    std::vector<char> code;
+    std::vector<Op> ops;
+    std::vector<int> jumps;
+    std::vector<Instr<Cell>> instrs;                 // ops encoded for the run loops
+    std::vector<MultiplyTarget> multiply_table; // targets of their Multiply ops
+
+    // source positions, kept only when profiling
+    std::vector<size_t> code_offsets;   // source offset of each command
+    std::vector<size_t> line_starts;    // source offset of each line
+
+    // state after executing the program prefix at compile time
+    long pre_exec_steps = 0;            // step budget, 0 to disable
+    std::vector<Cell> start_tape;
+    int start_ptr = 0;
+    int start_pc = 0;
+    std::vector<uint8_t> start_output;
+
+    // compiled program cache, keyed by the source contents; not used when
+    // profiling, which needs the source positions
+    std::string cache_dir;              // empty to disable
+    uint64_t source_hash = 0;
+    uint64_t source_size = 0;
+    bool from_cache = false;
+
+    // cells the program can reach, when static; the tape is then allocated
+    // up front and run without bounds checks. 0 if not known
+    size_t tape_extent = 0;
+
+    // tiered execution: the -O3 passes have not run, and run_counted()
+    // counts the back edges of each loop until one gets hot
+    bool tier0 = false;
+    std::vector<uint32_t> back_edges;   // by EndLoop op
+
+    // checkpoints written at loop back edges when requested
+    std::string checkpoint_file;
+    double checkpoint_interval = 0;     // seconds, 0 for SIGUSR1 only
+    bool checkpoints_started = false;   // by this run
+    unsigned checkpoint_signals_seen = 0;
+    std::chrono::steady_clock::time_point next_checkpoint;
+
+    // run budget, charged every poll_interval loop iterations
+    uint64_t step_budget = 0;           // loop iterations, 0 for no limit
+    double time_budget = 0;             // seconds, 0 for no limit
+    uint64_t steps_run = 0;             // iterations before the current period
+    int64_t poll_period = 0;            // iterations of the current period
+    std::chrono::steady_clock::time_point deadline;
+    RunStatus status = RunStatus::Finished;
+
+    int ptr = 0;         // pointer to the tape
+    int pc = 0;          // program counter
+    bool trace = false;
+    bool profile = false;
+    bool tape_profile = false;
+    bool guard_tape = false;
+    Engine engine = Engine::Switch;
+
+    void clear_code();
+    void load_source(const char* text, size_t size);
+    void filter_source(const char* text, size_t size);
+    void filter_code(const char* text, size_t size, size_t base, int& nesting, int& tape_pos);
+    void lower_commands();
+    void find_clears();
+    void find_scans();
+    void find_multiplies();
+    void fold_offsets();
+    void fold_runs();
+    void propagate_values();
+    void flatten_ifs();
+    void compute_jumps();
+    void encode_instrs();
+    void encode_ops();
+    void encode_start();
+    void encode_program();
+    void optimize_program();
+    void optimize_hot_program();
+    void pre_execute();
+
+    // optimization passes, run in this order after lower_commands(); each
+    // one runs at -O levels from its level up, unless set_pass() says not
+    struct Pass {
+        const char* name;
+        int level;
+        void (BFVM::*run)();
+    };
+    static const int pass_count = 7;
+    static const Pass passes[pass_count];
+    uint32_t enabled_passes = 0;        // bit k for passes[k]
+    std::string dump_pass;              // "lower", a pass, "all" or empty
+    std::ostream* dump_out = nullptr;
+
+    struct PassStats {
+        const char* name;
+        double seconds;
+        size_t ops_in;
+        size_t ops_out;
+    };
+    std::vector<PassStats> pass_stats;  // of the last compilation
+
+    void run_passes(int min_level, int max_level);
+    void end_pass(const char* name, std::chrono::steady_clock::time_point start, size_t ops_in);
+
+    bool use_cache() const {
+        return !cache_dir.empty() && !profile && dump_out == nullptr;
+    }
+    std::string cache_file() const;
+    bool load_cache();
+    bool valid_bytecode() const;
+    void store_cache() const;
+
+    void emit_c_ops(std::ostream& out, int begin, int end, int indent,
+                    std::vector<std::string>& functions) const;
+
+    void reach_of_ops(int& below, int& above) const;
+    size_t static_tape_extent() const;
+
+    uint64_t ops_hash() const;
+    void start_checkpoints();
+    bool checkpoint_due() const;
+    void write_checkpoint(int p, int at_pc);
+
+    void start_polls();
+    int64_t poll(int p, int at_pc);
+    void write_text(const std::string& text);
+
+    // the unchecked loops rely on a static tape extent or on the guard pages
+    // of the tape to detect accesses out of bounds
+    void run_traced();
+    void run_profiled();
+    template<bool Checked> void run_switch();
+    template<bool Checked> void run_threaded();
+    template<bool Checked> bool run_counted();
+    void run_jit(bool checked);
+
+    // called from the JIT code
+    friend class JitCompiler;
+    static void jit_grow(JitState* st, int64_t p);
+    static void jit_underflow();
+    static void jit_input(JitState* st, int64_t p);
+    static void jit_output(JitState* st, int64_t p);
+    static int64_t jit_scan(JitState* st, int64_t p, int64_t stride);
+    static void jit_poll(JitState* st, int64_t p, int64_t at_pc);
+
+    // shared slow paths of the run loops
+    void check_ptr(int p);
+    template<bool Checked>
+    Cell& cell(int p) {
+        if (Checked && static_cast<size_t>(p) >= tape.size()) {
+            check_ptr(p);
+        }
+        return tape[p];
+    }
+    template<bool Checked> void multiply(const Op& op, int p);
+    template<bool Checked> void multiply(const MultiplyTarget* entry, int p);
+    int scan(int stride, int p);
+
+    // execution profile
+    static const int profile_buckets = 34;  // iterations 0, 1, 2-3, 4-7, ...
+    struct LoopProfile {
+        int start = 0;                      // StartLoop op
+        uint64_t iterations = 0;            // of the current entry
+        uint64_t histogram[profile_buckets] = {};
+    };
+    std::vector<uint64_t> op_counts;
+    std::vector<LoopProfile> loop_profiles;
+
+    // tape profile: the reads and writes of each cell, and the cells moved
+    // by Move and Scan ops, counted in the innermost loop of the op
+    struct TapeCell {
+        uint64_t reads = 0;
+        uint64_t writes = 0;
+    };
+    struct TapeLoop {
+        int base = 0;                       // cell of cells[0]
+        std::vector<TapeCell> cells;
+        uint64_t travel = 0;
+    };
+    std::vector<TapeLoop> tape_loops;       // the top level, then by loop_profiles
+
+    static void count_access(TapeLoop& loop, int c, int reads, int writes) {
+        if (loop.cells.empty()) {
+            loop.base = c;
+        }
+        else if (c < loop.base) {
+            // grow by doubling towards cell 0 too, for programs that walk left
+            int grow = std::min(std::max(loop.base - c, static_cast<int>(loop.cells.size())), loop.base);
+            loop.cells.insert(loop.cells.begin(), grow, TapeCell());
+            loop.base -= grow;
+        }
+        if (c - loop.base >= static_cast<int>(loop.cells.size())) {
+            loop.cells.resize(c - loop.base + 1);
+        }
+        loop.cells[c - loop.base].reads += reads;
+        loop.cells[c - loop.base].writes += writes;
+    }
+
+    std::pair<size_t, size_t> source_line_column(size_t offset) const;
+    std::string source_position(int source) const;
+
+    // handler of each op for run_threaded(), kept out of its frame
+    std::vector<const void*> threaded_handlers;
+};
+
+#ifdef BF_HAVE_GUARD_TAPE
+// size in bytes of a guarded tape: address space only, pages are committed
+// on use
+static const size_t guarded_tape_size = static_cast<size_t>(1) << 30;
+
+// guard regions of the guarded tape of each thread, for the SIGSEGV
+// handler, which runs on the faulting thread
+static thread_local uint8_t* guard_before_begin = nullptr;
+static thread_local uint8_t* guard_before_end = nullptr;
+static thread_local uint8_t* guard_after_begin = nullptr;
+static thread_local uint8_t* guard_after_end = nullptr;
+#endif
+
+#ifdef BF_HAVE_ESCAPE
+static thread_local sigjmp_buf* escape_point = nullptr;     // innermost run_escapable()
+static thread_local const char* escape_message = nullptr;   // of a guard page fault
+static thread_local std::exception_ptr escape_error;        // of a JIT helper
+
+#ifdef BF_HAVE_GUARD_TAPE
+// the SIGSEGV and SIGBUS actions of the process before the first guarded
+// run, restored when the last one returns; runs on other threads overlap
+static std::mutex guard_handler_mutex;
+static int guard_handler_users = 0;
+static struct sigaction previous_segv_action;
+static struct sigaction previous_bus_action;
+
+// the faulting access comes from the run loops, which run under
+// run_escapable() and hold nothing to destroy
+static void guard_fault_handler(int sig, siginfo_t* info, void* context) {
+    uint8_t* addr = static_cast<uint8_t*>(info->si_addr);
+    const char* msg = nullptr;
+    if (addr >= guard_before_begin && addr < guard_before_end) {
+        msg = "Tape pointer underflow";
+    }
+    else if (addr >= guard_after_begin && addr < guard_after_end) {
+        msg = "Tape pointer overflow";
+    }
+    if (msg != nullptr && escape_point != nullptr) {
+        escape_message = msg;
+        siglongjmp(*escape_point, 1);
+    }
+
+    // not ours: chain to the previous handler, or let the default action
+    // run when the access restarts
+    const struct sigaction& previous = (sig == SIGBUS) ? previous_bus_action : previous_segv_action;
+    if ((previous.sa_flags & SA_SIGINFO) != 0) {
+        previous.sa_sigaction(sig, info, context);
+    }
+    else if (previous.sa_handler != SIG_DFL && previous.sa_handler != SIG_IGN) {
+        previous.sa_handler(sig);
+    }
+    else {
+        signal(sig, SIG_DFL);
+    }
+}
+#endif
+
+// run body, throwing the errors that escaped from it by longjmp; an escape
+// with no error stops the run
+template<typename F>
+static void run_escapable(F&& body) {
+    sigjmp_buf here;
+    sigjmp_buf* volatile outer = escape_point;
+    if (sigsetjmp(here, 1) != 0) {
+        escape_point = outer;
+        if (escape_message != nullptr) {
+            const char* msg = escape_message;
+            escape_message = nullptr;
+            error(msg);
+        }
+        if (escape_error) {
+            std::exception_ptr e = escape_error;
+            escape_error = nullptr;
+            std::rethrow_exception(e);
+        }
+        return;
+    }
+
+    escape_point = &here;
+    try {
+        body();
+    }
+    catch (...) {
+        escape_point = outer;
+        throw;
+    }
+    escape_point = outer;
+}
+
+// leave the JIT code for run_escapable(), with the error thrown by body if any
+template<typename F>
+static void escape_from_jit(F&& body) {
+    try {
+        body();
+        return;
+    }
+    catch (...) {
+        escape_error = std::current_exception();
+    }
+    siglongjmp(*escape_point, 1);
+}
+#else
+template<typename F>
+static void run_escapable(F&& body) {
+    body();
+}
+#endif
+
+#ifdef BF_HAVE_GUARD_TAPE
+static size_t round_to_pages(size_t n) {
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    return (n + page - 1) / page * page;
+}
+#endif
+
+// the guard page fault handler, installed for the duration of a guarded run
+class GuardHandler {
+public:
+    GuardHandler() = default;
+    GuardHandler(const GuardHandler&) = delete;
+    GuardHandler& operator=(const GuardHandler&) = delete;
+    ~GuardHandler();
+
+    bool install();     // false if not available
+
+private:
+    bool installed = false;
+};
+
+bool GuardHandler::install() {
+#ifdef BF_HAVE_GUARD_TAPE
+    std::lock_guard<std::mutex> lock(guard_handler_mutex);
+    if (guard_handler_users == 0) {
+        struct sigaction action;
+        std::memset(&action, 0, sizeof(action));
+        action.sa_sigaction = guard_fault_handler;
+        action.sa_flags = SA_SIGINFO;
+        sigemptyset(&action.sa_mask);
+        if (sigaction(SIGSEGV, &action, &previous_segv_action) != 0) {
+            return false;
+        }
+        if (sigaction(SIGBUS, &action, &previous_bus_action) != 0) {
+            sigaction(SIGSEGV, &previous_segv_action, nullptr);
+            return false;
+        }
+    }
+    guard_handler_users++;
+    installed = true;
+#endif
+    return installed;
+}
+
+GuardHandler::~GuardHandler() {
+#ifdef BF_HAVE_GUARD_TAPE
+    if (installed) {
+        std::lock_guard<std::mutex> lock(guard_handler_mutex);
+        if (--guard_handler_users == 0) {
+            sigaction(SIGSEGV, &previous_segv_action, nullptr);
+            sigaction(SIGBUS, &previous_bus_action, nullptr);
+        }
+    }
+#endif
+}
+
+template<typename Cell>
+Tape<Cell>::~Tape() {
+    unmap();
+}
+
+template<typename Cell>
+void Tape<Cell>::reset() {
+    unmap();
+    heap.assign(1, 0);
+    base = heap.data();
+    length = heap.size();
+}
+
+// map a guarded tape able to catch accesses up to guard_before cells below
+// cell 0 and guard_after cells past its end; false if not available
+template<typename Cell>
+bool Tape<Cell>::reset_guarded(size_t guard_before, size_t guard_after) {
+    unmap();
+    heap.clear();
+    base = nullptr;
+    length = 0;
+#ifdef BF_HAVE_GUARD_TAPE
+    if (sizeof(void*) < 8) {
+        return false;   // not enough address space to reserve
+    }
+
+    guard_before = round_to_pages((guard_before + 1) * sizeof(Cell));
+    guard_after = round_to_pages((guard_after + 1) * sizeof(Cell));
+    size_t total = guard_before + guarded_tape_size + guard_after;
+
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_NORESERVE
+    flags |= MAP_NORESERVE;
+#endif
+    void* mem = mmap(nullptr, total, PROT_NONE, flags, -1, 0);
+    if (mem == MAP_FAILED) {
+        return false;
+    }
+    uint8_t* start = static_cast<uint8_t*>(mem);
+    if (mprotect(start + guard_before, guarded_tape_size, PROT_READ | PROT_WRITE) != 0) {
+        munmap(mem, total);
+        return false;
+    }
+
+    mapping = mem;
+    mapping_size = total;
+    base = reinterpret_cast<Cell*>(start + guard_before);
+    length = guarded_tape_size / sizeof(Cell);
+
+    guard_before_begin = start;
+    guard_before_end = start + guard_before;
+    guard_after_begin = start + guard_before + guarded_tape_size;
+    guard_after_end = start + total;
+    return true;
+#else
+    (void)guard_before;
+    (void)guard_after;
+    return false;
+#endif
+}
+
+template<typename Cell>
+void Tape<Cell>::resize(size_t n) {
+    if (guarded()) {
+        if (n > length) {
+            error("Tape pointer overflow");
+        }
+        return;
+    }
+    heap.resize(n, 0);
+    base = heap.data();
+    length = heap.size();
+}
+
+template<typename Cell>
+size_t Tape<Cell>::used_size() const {
+#ifdef BF_HAVE_GUARD_TAPE
+    if (guarded()) {
+        // pages never touched are not resident and hold only zeros
+        size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        size_t bytes = length * sizeof(Cell);
+        size_t pages = bytes / page;
+#ifdef __APPLE__
+        std::vector<char> resident(pages);
+#else
+        std::vector<unsigned char> resident(pages);
+#endif
+        if (mincore(base, bytes, resident.data()) != 0) {
+            return length;
+        }
+        while (pages > 0 && (resident[pages - 1] & 1) == 0) {
+            pages--;
+        }
+        return pages * page / sizeof(Cell);
+    }
+#endif
+    return length;
+}
+
+template<typename Cell>
+void Tape<Cell>::unmap() {
+#ifdef BF_HAVE_GUARD_TAPE
+    if (mapping != nullptr) {
+        munmap(mapping, mapping_size);
+        mapping = nullptr;
+        guard_before_begin = guard_before_end = nullptr;
+        guard_after_begin = guard_after_end = nullptr;
+    }
+#endif
+}
+
+// 64-bit hash of a source text, eight bytes at a time
+static uint64_t hash_bytes(const char* data, size_t size) {
+    auto mix = [](uint64_t h) {
+        h ^= h >> 33;
+        h *= 0xFF51AFD7ED558CCDull;
+        h ^= h >> 33;
+        h *= 0xC4CEB9FE1A85EC53ull;
+        h ^= h >> 33;
+        return h;
+    };
+
+    uint64_t hash = mix(size);
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, data + i, sizeof(word));
+        hash = (hash ^ mix(word)) * 0x9E3779B97F4A7C15ull;
+    }
+    uint64_t tail = 0;
+    std::memcpy(&tail, data + i, size - i);
+    return mix(hash ^ mix(tail + 1));
+}
+
+// keeps only the BF commands of the text, checking the brackets on the way;
+// base is the offset of the text in the source
+template<typename Cell>
+void BFVM<Cell>::filter_code(const char* text, size_t size, size_t base, int& nesting, int& tape_pos) {
+    auto command = [&](char ch) {
+        if (ch == '>') {
+            tape_pos++;
+        }
+        else if (ch == '<') {
+            if (--tape_pos < 0) {
+                error("Tape pointer underflow");
+            }
+        }
+        else if (ch == '[') {
+            nesting++;
+        }
+        else if (ch == ']') {
+            if (--nesting < 0) {
+                error("Unmatched ']'");
+            }
+        }
+        code.push_back(ch);
+    };
+
+    size_t i = 0;
+    if (profile) {
+        // keep the source position of each command, and where lines start
+        for (; i < size; i++) {
+            char ch = text[i];
+            if (ch == '\n') {
+                line_starts.push_back(base + i + 1);
+            }
+            else if (ch == '>' || ch == '<' || ch == '+' || ch == '-' ||
+                     ch == '.' || ch == ',' || ch == '[' || ch == ']') {
+                code_offsets.push_back(base + i);
+                command(ch);
+            }
+        }
+    }
+
+#if defined(__SSE2__)
+    // classify 16 characters at a time, skip blocks without commands
+    const __m128i cmds[] = {
+        _mm_set1_epi8('>'), _mm_set1_epi8('<'), _mm_set1_epi8('+'), _mm_set1_epi8('-'),
+        _mm_set1_epi8('.'), _mm_set1_epi8(','), _mm_set1_epi8('['), _mm_set1_epi8(']'),
+    };
+    for (; i + 16 <= size; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text + i));
+        __m128i hit = _mm_setzero_si128();
+        for (const auto& cmd : cmds) {
+            hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, cmd));
+        }
+        uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(hit));
+        while (mask != 0) {
+            command(text[i + __builtin_ctz(mask)]);
+            mask &= mask - 1;
+        }
+    }
+#endif
+
+    for (; i < size; i++) {
+        char ch = text[i];
+        if (ch == '>' || ch == '<' || ch == '+' || ch == '-' ||
+                ch == '.' || ch == ',' || ch == '[' || ch == ']') {
+            command(ch);
+        }
+    }
+}
+
+// -O levels: 1 folds runs and offsets, 2 adds the loop idioms, 3 the
+// dataflow passes, which tiered execution leaves until a loop gets hot
+static const int max_opt_level = 3;
+static const int tier0_opt_level = 2;
+
+template<typename Cell>
+const typename BFVM<Cell>::Pass BFVM<Cell>::passes[pass_count] = {
+    { "clears",     2, &BFVM<Cell>::find_clears },
+    { "scans",      2, &BFVM<Cell>::find_scans },
+    { "multiplies", 2, &BFVM<Cell>::find_multiplies },
+    { "offsets",    1, &BFVM<Cell>::fold_offsets },
+    { "runs",       1, &BFVM<Cell>::fold_runs },
+    { "values",     3, &BFVM<Cell>::propagate_values },
+    { "ifs",        3, &BFVM<Cell>::flatten_ifs },
+};
+
+// program I/O on stdin and stdout until set otherwise
+template<typename Cell>
+BFVM<Cell>::BFVM() {
+    set_opt_level(max_opt_level);
+    program_input.reset(0);
+    program_output.reset(1, FlushPolicy::Auto);
+    program_input.set_prompt(&program_output);
+}
+
+template<typename Cell>
+void BFVM<Cell>::clear_code() {
+    code.clear();
+    code_offsets.clear();
+    line_starts.assign(1, 0);
+}
+
+template<typename Cell>
+void BFVM<Cell>::read_code(std::istream& in) {
+    if (use_cache()) {
+        // the cache key needs the whole source before filtering
+        std::string text((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        load_source(text.data(), text.size());
+        return;
+    }
+
+    clear_code();
+    int nesting = 0;
+    int tape_pos = 0;
+
+    // read in blocks, unformatted
+    std::vector<char> block(64 * 1024);
+    size_t base = 0;
+    while (in.read(block.data(), block.size()) || in.gcount() > 0) {
+        size_t count = static_cast<size_t>(in.gcount());
+        filter_code(block.data(), count, base, nesting, tape_pos);
+        base += count;
+    }
+
+    if (nesting != 0) {
+        error("Unmatched '['");
+    }
+}
+
+// map regular files in memory and filter them in place; anything else is
+// read through the iostreams
+template<typename Cell>
+void BFVM<Cell>::read_file(const char* filename) {
+#ifdef BF_HAVE_MMAP_LOADER
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        error("Cannot open file: " + std::string(filename));
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        size_t size = static_cast<size_t>(st.st_size);
+        void* text = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (text != MAP_FAILED) {
+            close(fd);
+#ifdef MADV_SEQUENTIAL
+            madvise(text, size, MADV_SEQUENTIAL);
+#endif
+            load_source(static_cast<const char*>(text), size);
+            munmap(text, size);
+            return;
+        }
+    }
+    close(fd);
+#endif
+
+    std::ifstream file(filename, std::ios::binary);
+    if (!file) {
+        error("Cannot open file: " + std::string(filename));
+    }
+    read_code(file);
+}
+
+// a whole source in memory: filtered, unless its compiled form is cached
+template<typename Cell>
+void BFVM<Cell>::load_source(const char* text, size_t size) {
+    from_cache = false;
+    if (use_cache()) {
+        source_hash = hash_bytes(text, size);
+        source_size = size;
+        if (load_cache()) {
+            from_cache = true;
+            return;
+        }
+    }
+    filter_source(text, size);
+}
+
+template<typename Cell>
+void BFVM<Cell>::filter_source(const char* text, size_t size) {
+    clear_code();
+    code.reserve(size);
+    int nesting = 0;
+    int tape_pos = 0;
+    filter_code(text, size, 0, nesting, tape_pos);
+
+    if (nesting != 0) {
+        error("Unmatched '['");
+    }
+}
+
+template<typename Cell>
+void BFVM<Cell>::compile_code() {
+    // else the ops and start state were loaded by load_source()
+    if (!from_cache) {
+        pass_stats.clear();
+        auto start = std::chrono::steady_clock::now();
+        lower_commands();
+        end_pass("lower", start, code.size());
+
+        // tiered execution leaves the dataflow passes until a loop gets hot
+        tier0 = (engine == Engine::Tiered);
+        run_passes(1, tier0 ? tier0_opt_level : max_opt_level);
+        encode_program();
+    }
+
+    tape_extent = static_tape_extent();
+}
+
+template<typename Cell>
+void BFVM<Cell>::set_opt_level(int level) {
+    if (level < 0 || level > max_opt_level) {
+        error("Invalid optimization level: " + std::to_string(level));
+    }
+    enabled_passes = 0;
+    for (int k = 0; k < pass_count; k++) {
+        if (passes[k].level <= level) {
+            enabled_passes |= 1u << k;
+        }
+    }
+}
+
+template<typename Cell>
+void BFVM<Cell>::set_pass(const std::string& name, bool enabled) {
+    for (int k = 0; k < pass_count; k++) {
+        if (name == passes[k].name) {
+            if (enabled) {
+                enabled_passes |= 1u << k;
+            }
+            else {
+                enabled_passes &= ~(1u << k);
+            }
+            return;
+        }
+    }
+    error("Unknown pass: " + name);
+}
+
+template<typename Cell>
+void BFVM<Cell>::set_dump_ir(const std::string& pass, std::ostream* out) {
+    bool known = (pass == "lower" || pass == "all");
+    for (int k = 0; k < pass_count; k++) {
+        known = known || pass == passes[k].name;
+    }
+    if (!known) {
+        error("Unknown pass: " + pass);
+    }
+    dump_pass = pass;
+    dump_out = out;
+}
+
+// runs the enabled passes of levels min_level..max_level, in order; the
+// jumps are left to encode_program()
+template<typename Cell>
+void BFVM<Cell>::run_passes(int min_level, int max_level) {
+    for (int k = 0; k < pass_count; k++) {
+        const Pass& pass = passes[k];
+        if (pass.level >= min_level && pass.level <= max_level && (enabled_passes & (1u << k)) != 0) {
+            auto start = std::chrono::steady_clock::now();
+            size_t ops_in = ops.size();
+            (this->*pass.run)();
+            end_pass(pass.name, start, ops_in);
+        }
+    }
+}
+
+// records the statistics of a pass and dumps the ops if asked to
+template<typename Cell>
+void BFVM<Cell>::end_pass(const char* name, std::chrono::steady_clock::time_point start, size_t ops_in) {
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    pass_stats.push_back({ name, elapsed.count(), ops_in, ops.size() });
+
+    if (dump_out != nullptr && (dump_pass == name || dump_pass == "all")) {
+        std::ostream& out = *dump_out;
+        out << "IR after " << name << ": " << ops.size() << " ops\n";
+        int depth = 0;
+        for (int i = 0; i < static_cast<int>(ops.size()); i++) {
+            if (ops[i].type == OpType::EndLoop) {
+                depth--;
+            }
+            out << std::setw(6) << i << "  " << std::string(2 * depth, ' ') << ops[i].to_string() << "\n";
+            if (ops[i].type == OpType::StartLoop) {
+                depth++;
+            }
+        }
+        out << std::flush;
+    }
+}
+
+// time and op count of each pass of the last compilation; ops_in of the
+// lowering is the count of commands
+template<typename Cell>
+void BFVM<Cell>::write_pass_stats(std::ostream& out) const {
+    if (from_cache) {
+        out << "Pass stats: the program was loaded from the cache\n";
+        return;
+    }
+    double total = 0;
+    out << "Pass stats:\n"
+        << "  pass            ms       ops   change\n";
+    for (const auto& stats : pass_stats) {
+        total += stats.seconds;
+        int64_t change = static_cast<int64_t>(stats.ops_out) - static_cast<int64_t>(stats.ops_in);
+        out << "  " << std::left << std::setw(10) << stats.name << std::right
+            << std::fixed << std::setprecision(3) << std::setw(10) << stats.seconds * 1000
+            << std::setw(10) << stats.ops_out
+            << std::setw(9) << std::showpos << change << std::noshowpos;
+        if (stats.ops_in > 0) {
+            out << " (" << std::setprecision(1) << 100.0 * static_cast<double>(change) / static_cast<double>(stats.ops_in) << "%)";
+        }
+        out << "\n";
+    }
+    out << "  " << std::left << std::setw(10) << "total" << std::right
+        << std::setprecision(3) << std::setw(10) << total * 1000 << "\n";
+    out << std::defaultfloat << std::setprecision(6) << std::flush;
+}
+
+// jumps and run loop encoding of the ops, starting at the first one
+template<typename Cell>
+void BFVM<Cell>::encode_ops() {
+    compute_jumps();
+    encode_instrs();
+
+    start_tape.clear();
+    start_output.clear();
+    start_ptr = start_pc = 0;
+}
+
+// pre-executed start state of the encoded ops, then the cache file
+template<typename Cell>
+void BFVM<Cell>::encode_start() {
+    if (pre_exec_steps > 0) {
+        pre_execute();
+    }
+
+    if (use_cache() && !tier0) {
+        store_cache();
+    }
+}
+
+template<typename Cell>
+void BFVM<Cell>::encode_program() {
+    encode_ops();
+    encode_start();
+}
+
+// tiered execution: run the -O3 passes left out by compile_code()
+template<typename Cell>
+void BFVM<Cell>::optimize_program() {
+    tier0 = false;
+    run_passes(tier0_opt_level + 1, max_opt_level);
+    encode_program();
+    tape_extent = static_tape_extent();
+}
+
+// the same in the middle of a run, which goes on from the live tape: the
+// start state and the cache file are left to encode_start() after the run
+template<typename Cell>
+void BFVM<Cell>::optimize_hot_program() {
+    tier0 = false;
+    run_passes(tier0_opt_level + 1, max_opt_level);
+    encode_ops();
+    tape_extent = static_tape_extent();
+}
+
+// take the compiled program of another VM, to run it on this VM's own tape
+template<typename Cell>
+void BFVM<Cell>::copy_program(const BFMachine& other) {
+    const BFVM* compiled = dynamic_cast<const BFVM*>(&other);
+    if (compiled == nullptr) {
+        error("Cannot copy a program of another cell width");
+    }
+    if (compiled == this) {
+        return;
+    }
+
+    ops = compiled->ops;
+    jumps = compiled->jumps;
+    instrs = compiled->instrs;
+    multiply_table = compiled->multiply_table;
+    start_tape = compiled->start_tape;
+    start_ptr = compiled->start_ptr;
+    start_pc = compiled->start_pc;
+    start_output = compiled->start_output;
+    tape_extent = compiled->tape_extent;
+    tier0 = compiled->tier0;
+    enabled_passes = compiled->enabled_passes;
+}
+
+// Compiled program cache, one file per source contents, in native byte order:
+//   header      magic "BFCC", version, cell width in bits, 0
+//   key         source size, source hash, pre-exec step budget, build id
+//   ops         count, then type, value, offset, source, target count and
+//               targets of each op
+//   bytecode    jumps, then the Instr records and the multiply side table,
+//               each as a count and the raw array
+//   start       ptr, pc, tape cells and output of the pre-execution
+//   checksum    hash of all the bytes before it
+// Bump cache_version when the ops change meaning; the build id already
+// tells apart the optimizers of different builds.
+static const char cache_magic[4] = { 'B', 'F', 'C', 'C' };
+static const uint32_t cache_version = 4;
+static const char* const cache_build_id = __DATE__ " " __TIME__;
+
+template<typename Cell>
+std::string BFVM<Cell>::cache_file() const {
+    std::ostringstream name;
+    name << cache_dir << "/" << std::hex << std::setfill('0') << std::setw(16) << source_hash
+         << "-" << std::dec << (8 * sizeof(Cell)) << "-" << pre_exec_steps
+         << "-" << std::hex << enabled_passes << ".bfc";
+    return name.str();
+}
+
+// loads the ops, bytecode and start state of the current source; false on
+// a miss or on a file that does not match
+template<typename Cell>
+bool BFVM<Cell>::load_cache() {
+    std::ifstream in(cache_file(), std::ios::binary);
+    if (!in) {
+        return false;
+    }
+    std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    uint64_t checksum = 0;
+    if (data.size() < sizeof(checksum)) {
+        return false;
+    }
+    std::memcpy(&checksum, data.data() + data.size() - sizeof(checksum), sizeof(checksum));
+    data.resize(data.size() - sizeof(checksum));
+    if (checksum != hash_bytes(data.data(), data.size())) {
+        return false;
+    }
+    size_t pos = 0;
+
+    auto get = [&](void* value, size_t size) {
+        if (size > data.size() - pos) {
+            return false;
+        }
+        std::memcpy(value, data.data() + pos, size);
+        pos += size;
+        return true;
+    };
+    auto get_u32 = [&](uint32_t expected) {
+        uint32_t value = 0;
+        return get(&value, sizeof(value)) && value == expected;
+    };
+    auto get_u64 = [&](uint64_t& value) {
+        return get(&value, sizeof(value));
+    };
+    auto get_vector = [&](auto& vec) {
+        uint64_t count = 0;
+        if (!get_u64(count) || count > (data.size() - pos) / sizeof(vec[0])) {
+            return false;
+        }
+        vec.resize(static_cast<size_t>(count));
+        return get(vec.data(), vec.size() * sizeof(vec[0]));
+    };
+
+    char magic[sizeof(cache_magic)];
+    uint64_t size = 0, hash = 0, steps = 0, build = 0, op_count = 0;
+    if (!get(magic, sizeof(magic)) || std::memcmp(magic, cache_magic, sizeof(magic)) != 0 ||
+            !get_u32(cache_version) || !get_u32(8 * sizeof(Cell)) || !get_u32(0) ||
+            !get_u64(size) || size != source_size || !get_u64(hash) || hash != source_hash ||
+            !get_u64(steps) || steps != static_cast<uint64_t>(pre_exec_steps) ||
+            !get_u64(build) || build != hash_bytes(cache_build_id, std::strlen(cache_build_id)) ||
+            !get_u64(op_count) || op_count > (data.size() - pos) / (5 * sizeof(int32_t))) {
+        return false;
+    }
+
+    ops.clear();
+    ops.reserve(static_cast<size_t>(op_count));
+    for (uint64_t i = 0; i < op_count; i++) {
+        int32_t fields[4];
+        uint32_t target_count = 0;
+        if (!get(fields, sizeof(fields)) || !get(&target_count, sizeof(target_count)) ||
+                fields[0] < 0 || fields[0] > static_cast<int32_t>(last_op_type) ||
+                target_count > (data.size() - pos) / sizeof(MultiplyTarget)) {
+            return false;
+        }
+        Op op(static_cast<OpType>(fields[0]), fields[1], fields[2]);
+        op.source = fields[3];
+        op.targets.resize(target_count);
+        if (!get(op.targets.data(), target_count * sizeof(MultiplyTarget))) {
+            return false;
+        }
+        ops.push_back(std::move(op));
+    }
+
+    uint64_t at_ptr = 0, at_pc = 0;
+    if (!get_vector(jumps) || !get_vector(instrs) || !get_vector(multiply_table) ||
+            !get_u64(at_ptr) || !get_u64(at_pc) ||
+            !get_vector(start_tape) || !get_vector(start_output) || pos != data.size() ||
+            jumps.size() != ops.size() || instrs.size() != ops.size() ||
+            at_pc > ops.size() || (!start_tape.empty() && at_ptr >= start_tape.size()) ||
+            !valid_bytecode()) {
+        ops.clear();
+        return false;
+    }
+    start_ptr = static_cast<int>(at_ptr);
+    start_pc = static_cast<int>(at_pc);
+    return true;
+}
+
+// the jumps and side table indexes of loaded bytecode stay inside the program
+template<typename Cell>
+bool BFVM<Cell>::valid_bytecode() const {
+    int count = static_cast<int>(ops.size());
+    for (int i = 0; i < count; i++) {
+        const Instr<Cell>& instr = instrs[i];
+        int jump = jumps[i];
+        if (instr.type != ops[i].type) {
+            return false;
+        }
+        switch (instr.type) {
+        case OpType::StartLoop:
+            if (jump <= i || jump >= count || ops[jump].type != OpType::EndLoop ||
+                    jumps[jump] != i || instr.arg != jump) {
+                return false;
+            }
+            break;
+        case OpType::EndLoop:
+            if (jump < 0 || jump >= i || ops[jump].type != OpType::StartLoop ||
+                    jumps[jump] != i || instr.arg != jump) {
+                return false;
+            }
+            break;
+        case OpType::If:
+            if (jump < i || jump >= count || instr.arg != jump) {
+                return false;
+            }
+            break;
+        case OpType::Multiply:
+            if (jump != -1 || instr.arg < 0 ||
+                    static_cast<size_t>(instr.arg) >= multiply_table.size() ||
+                    multiply_table[instr.arg].factor < 0 ||
+                    static_cast<size_t>(multiply_table[instr.arg].factor) >=
+                        multiply_table.size() - instr.arg) {
+                return false;
+            }
+            break;
+        case OpType::Scan:
+            if (jump != -1 || instr.arg == 0) {
+                return false;
+            }
+            break;
+        default:
+            if (jump != -1) {
+                return false;
+            }
+            break;
+        }
+    }
+    return true;
+}
+
+// failures to write the cache are not errors: the next run compiles again
+template<typename Cell>
+void BFVM<Cell>::store_cache() const {
+    std::error_code ec;
+    std::filesystem::create_directories(cache_dir, ec);
+
+    std::string filename = cache_file();
+    std::string temp_file = filename + ".tmp" + std::to_string(getpid());
+    std::ofstream out(temp_file, std::ios::binary);
+    if (!out) {
+        return;
+    }
+    std::string data;
+    auto put = [&](const void* value, size_t size) {
+        data.append(static_cast<const char*>(value), size);
+    };
+    auto put_u32 = [&](uint32_t value) {
+        put(&value, sizeof(value));
+    };
+    auto put_u64 = [&](uint64_t value) {
+        put(&value, sizeof(value));
+    };
+    auto put_vector = [&](const auto& vec) {
+        put_u64(vec.size());
+        put(vec.data(), vec.size() * sizeof(vec[0]));
+    };
+
+    put(cache_magic, sizeof(cache_magic));
+    put_u32(cache_version);
+    put_u32(8 * sizeof(Cell));
+    put_u32(0);
+    put_u64(source_size);
+    put_u64(source_hash);
+    put_u64(static_cast<uint64_t>(pre_exec_steps));
+    put_u64(hash_bytes(cache_build_id, std::strlen(cache_build_id)));
+
+    put_u64(ops.size());
+    for (const auto& op : ops) {
+        int32_t fields[4] = { static_cast<int32_t>(op.type), op.value, op.offset, op.source };
+        put(fields, sizeof(fields));
+        put_u32(static_cast<uint32_t>(op.targets.size()));
+        put(op.targets.data(), op.targets.size() * sizeof(MultiplyTarget));
+    }
+
+    put_vector(jumps);
+    put_vector(instrs);
+    put_vector(multiply_table);
+    put_u64(static_cast<uint64_t>(start_ptr));
+    put_u64(static_cast<uint64_t>(start_pc));
+    put_vector(start_tape);
+    put_vector(start_output);
+    put_u64(hash_bytes(data.data(), data.size()));
+
+    out.write(data.data(), data.size());
+    out.close();
+    if (!out || std::rename(temp_file.c_str(), filename.c_str()) != 0) {
+        std::remove(temp_file.c_str());
+    }
+}
+
+// largest tape the compile-time execution may build
+static const int pre_exec_tape_size = 1 << 20;
+
+// Runs the program from the zeroed tape until the first Input op, an error,
+// or the step budget, and keeps the tape, pointer and output reached before
+// that op. Any error is left for the run time to report.
+template<typename Cell>
+void BFVM<Cell>::pre_execute() {
+    std::vector<Cell> cells(1, 0);
+    std::vector<uint8_t> output;
+    int n = static_cast<int>(ops.size());
+    int p = 0;
+    int i = 0;
+    long steps = 0;
+
+    // cells written by the current op, to roll it back
+    struct Undo {
+        int cell;
+        Cell value;
+    };
+    std::vector<Undo> undo;
+    int op_ptr = 0;
+
+    // cell c, nullptr if out of bounds
+    auto at = [&](int c) -> Cell* {
+        if (c < 0 || c >= pre_exec_tape_size) {
+            return nullptr;
+        }
+        if (c >= static_cast<int>(cells.size())) {
+            cells.resize(c + 1, 0);
+        }
+        return &cells[c];
+    };
+    auto store = [&](Cell* cell, Cell value) {
+        undo.push_back({ static_cast<int>(cell - cells.data()), *cell });
+        *cell = value;
+    };
+
+    while (i < n && steps < pre_exec_steps) {
+        const Op& op = ops[i];
+        undo.clear();
+        op_ptr = p;
+        steps++;
+
+        Cell* cell = nullptr;
+        bool stop = false;
+        switch (op.type) {
+        case OpType::Move:
+            p += op.value;
+            stop = (at(p) == nullptr);
+            break;
+
+        case OpType::Clear:
+        case OpType::Set:
+            if ((cell = at(p + op.offset)) == nullptr) {
+                stop = true;
+            }
+            else {
+                store(cell, static_cast<Cell>(op.value));
+            }
+            break;
+
+        case OpType::Increment:
+            if ((cell = at(p + op.offset)) == nullptr) {
+                stop = true;
+            }
+            else {
+                store(cell, static_cast<Cell>(*cell + op.value));
+            }
+            break;
+
+        case OpType::Multiply: {
+            Cell* origin = at(p + op.offset);
+            if (origin == nullptr) {
+                stop = true;
+                break;
+            }
+            Cell origin_val = *origin;
+            if (origin_val == 0) {
+                break;
+            }
+            for (const auto& target : op.targets) {
+                if ((cell = at(p + op.offset + target.offset)) == nullptr) {
+                    stop = true;
+                    break;
+                }
+                store(cell, static_cast<Cell>(*cell + origin_val * target.factor));
+            }
+            if (!stop) {
+                store(&cells[p + op.offset], 0);
+            }
+            break;
+        }
+        case OpType::Scan:
+            while ((cell = at(p)) != nullptr && *cell != 0) {
+                p += op.value;
+                steps++;
+            }
+            stop = (cell == nullptr);
+            break;
+
+        case OpType::StartLoop:
+            if (cells[p] == 0) {
+                i = jumps[i];
+            }
+            break;
+
+        case OpType::EndLoop:
+            if (cells[p] != 0) {
+                i = jumps[i];
+            }
+            break;
+
+        case OpType::Input:
+            stop = true;
+            break;
+
+        case OpType::Output:
+            if ((cell = at(p + op.offset)) == nullptr) {
+                stop = true;
+            }
+            else {
+                output.push_back(static_cast<uint8_t>(*cell));
+            }
+            break;
+
+        case OpType::If:
+            if ((cell = at(p + op.offset)) == nullptr) {
+                stop = true;
+            }
+            else if (*cell == 0) {
+                i = jumps[i];
+            }
+            break;
+
+        default:
+            error("Invalid op");
+        }
+
+        if (stop) {
+            // resume at this op
+            for (size_t k = undo.size(); k-- > 0; ) {
+                cells[undo[k].cell] = undo[k].value;
+            }
+            p = op_ptr;
+            break;
+        }
+        i++;
+    }
+
+    // drop the zeros past the last cell in use
+    size_t used = cells.size();
+    while (used > 1 && used > static_cast<size_t>(p) + 1 && cells[used - 1] == 0) {
+        used--;
+    }
+    cells.resize(used);
+
+    start_tape = std::move(cells);
+    start_output = std::move(output);
+    start_ptr = p;
+    start_pc = i;
+}
+
+// inverse of an odd number modulo the cell size, by Newton's iteration:
+// each step doubles the number of correct low bits, starting from 3
+template<typename Cell>
+static Cell inverse_of(int value) {
+    uint32_t v = static_cast<uint32_t>(value);
+    uint32_t inverse = v;
+    for (int i = 0; i < 4; i++) {
+        inverse *= 2 - v * inverse;
+    }
+    return static_cast<Cell>(inverse);
+}
+
+// value modulo the cell size, as a signed number: -128..127 for bytes
+template<typename Cell>
+static int wrap_cell(int64_t value) {
+    return static_cast<typename std::make_signed<Cell>::type>(static_cast<Cell>(value));
+}
+
+// one op per command, offsets 0; the passes rewrite them
+template<typename Cell>
+void BFVM<Cell>::lower_commands() {
+    ops.clear();
+    ops.reserve(code.size());
+    for (size_t i = 0; i < code.size(); i++) {
+        OpType type = OpType::Move;
+        int value = 0;
+        switch (code[i]) {
+        case '>':
+            value = 1;
+            break;
+        case '<':
+            value = -1;
+            break;
+        case '+':
+            type = OpType::Increment;
+            value = 1;
+            break;
+        case '-':
+            type = OpType::Increment;
+            value = -1;
+            break;
+        case '[':
+            type = OpType::StartLoop;
+            break;
+        case ']':
+            type = OpType::EndLoop;
+            break;
+        case ',':
+            type = OpType::Input;
+            break;
+        case '.':
+            type = OpType::Output;
+            break;
+        default:
+            error("Invalid command " + std::string(1, code[i]));
+        }
+        ops.emplace_back(type, value);
+        ops.back().source = static_cast<int>(i);
+    }
+    compute_jumps();
+}
+
+// Replaces each innermost loop for which replace(start, end, op) returns
+// true by op, which takes the source of the StartLoop; compacts the ops in
+// place
+template<typename F>
+static void replace_loops(std::vector<Op>& ops, F replace) {
+    int n = static_cast<int>(ops.size());
+    int out = 0;
+    for (int i = 0; i < n; i++) {
+        int end = i + 1;
+        if (ops[i].type == OpType::StartLoop) {
+            while (end < n && ops[end].type != OpType::StartLoop && ops[end].type != OpType::EndLoop) {
+                end++;
+            }
+        }
+        Op op(OpType::Clear);
+        if (end < n && ops[end].type == OpType::EndLoop && ops[i].type == OpType::StartLoop &&
+                replace(i, end, op)) {
+            op.source = ops[i].source;
+            ops[out++] = std::move(op);
+            i = end;
+        }
+        else if (out != i) {
+            ops[out++] = std::move(ops[i]);
+        }
+        else {
+            out++;
+        }
+    }
+    ops.resize(out, Op(OpType::Clear));
+}
+
+// [-], [+], [---]: loops that only step their own cell by an odd amount
+// reach zero
+template<typename Cell>
+void BFVM<Cell>::find_clears() {
+    replace_loops(ops, [&](int start, int end, Op& op) {
+        int step = 0;
+        for (int k = start + 1; k < end; k++) {
+            if (ops[k].type != OpType::Increment || ops[k].offset != 0) {
+                return false;
+            }
+            step += ops[k].value;
+        }
+        op = Op(OpType::Clear);
+        return step % 2 != 0;
+    });
+}
+
+// loops with only moves: [>], [<<], [>>>>], ...
+template<typename Cell>
+void BFVM<Cell>::find_scans() {
+    replace_loops(ops, [&](int start, int end, Op& op) {
+        int stride = 0;
+        for (int k = start + 1; k < end; k++) {
+            if (ops[k].type != OpType::Move) {
+                return false;
+            }
+            stride += ops[k].value;
+        }
+        op = Op(OpType::Scan, stride);
+        return stride != 0;
+    });
+}
+
+// affine loops: the body only adds to cells and returns to the control
+// cell. If the control cell steps by an odd amount, it reaches zero after
+// value * -1/step (mod 2^bits) iterations, and every other cell gains that
+// many times its own step.
+template<typename Cell>
+void BFVM<Cell>::find_multiplies() {
+    replace_loops(ops, [&](int start, int end, Op& op) {
+        std::vector<MultiplyTarget> steps;     // in order of first access
+        int current_offset = 0;
+        for (int k = start + 1; k < end; k++) {
+            if (ops[k].type == OpType::Move) {
+                current_offset += ops[k].value;
+            }
+            else if (ops[k].type == OpType::Increment) {
+                int cell = current_offset + ops[k].offset;
+                auto step = std::find_if(steps.begin(), steps.end(), [&](const MultiplyTarget& t) {
+                    return t.offset == cell;
+                });
+                if (step == steps.end()) {
+                    steps.push_back({ cell, 0 });
+                    step = steps.end() - 1;
+                }
+                step->factor += ops[k].value;
+            }
+            else {
+                return false;
+            }
+        }
+
+        int control = 0;
+        for (const auto& step : steps) {
+            if (step.offset == 0) {
+                control = step.factor;
+            }
+        }
+        if (current_offset != 0 || control % 2 == 0) {
+            return false;
+        }
+
+        int64_t iterations = -static_cast<int64_t>(inverse_of<Cell>(control));  // per unit of value
+        std::vector<MultiplyTarget> targets;
+        for (const auto& step : steps) {
+            int factor = wrap_cell<Cell>(step.factor * iterations);
+            if (step.offset != 0 && factor != 0) {
+                targets.push_back({ step.offset, factor });
+            }
+        }
+        op = Op(targets.empty() ? OpType::Clear : OpType::Multiply);
+        op.targets = std::move(targets);
+        return true;
+    });
+}
+
+// Defers the pointer movement of each basic block to its end, addressing
+// the cells of its ops by offset; runs before the passes that make Ifs
+template<typename Cell>
+void BFVM<Cell>::fold_offsets() {
+    std::vector<Op> out;
+    out.reserve(ops.size());
+    int offset = 0;     // pending pointer movement of the current basic block
+    int move_source = 0;
+
+    for (auto& op : ops) {
+        switch (op.type) {
+        case OpType::Move:
+            if (offset == 0) {
+                move_source = op.source;
+            }
+            offset += op.value;
+            continue;
+        case OpType::Scan:
+        case OpType::StartLoop:
+        case OpType::EndLoop:
+            if (offset != 0) {
+                out.push_back(Op(OpType::Move, offset));
+                out.back().source = move_source;
+                offset = 0;
+            }
+            break;
+        default:
+            op.offset += offset;
+            break;
+        }
+        out.push_back(std::move(op));
+    }
+    if (offset != 0) {
+        out.push_back(Op(OpType::Move, offset));
+        out.back().source = move_source;
+    }
+    ops = std::move(out);
+}
+
+// Run-length folding: adjacent moves add up, and so do the increments of a
+// cell in a run of increments, which commute; ops that add up to 0 go
+template<typename Cell>
+void BFVM<Cell>::fold_runs() {
+    std::vector<Op> out;
+    out.reserve(ops.size());
+
+    for (auto& op : ops) {
+        if (op.type == OpType::Move && !out.empty() && out.back().type == OpType::Move) {
+            out.back().value += op.value;
+            if (out.back().value == 0) {
+                out.pop_back();
+            }
+            continue;
+        }
+        if (op.type == OpType::Increment) {
+            // the merged increment keeps the source of the first one
+            for (size_t k = out.size(); k-- > 0 && out[k].type == OpType::Increment; ) {
+                if (out[k].offset == op.offset) {
+                    op.value += out[k].value;
+                    op.source = out[k].source;
+                    out.erase(out.begin() + k);
+                    break;
+                }
+            }
+            if (op.value == 0) {
+                continue;
+            }
+        }
+        out.push_back(std::move(op));
+    }
+    ops = std::move(out);
+}
+
+// What the body of a loop does, with offsets relative to the loop cell
+struct LoopSummary {
+    int base = 0;                       // pointer at the StartLoop, while summarizing
+    bool balanced = true;               // each iteration ends on the loop cell, no scans
+    bool straight = true;               // no inner loops
+    std::vector<int> writes;            // cells written, sorted
+    std::vector<int> counter;           // ops that write the loop cell outside inner loops
+    bool counter_known = true;          // counter holds all the writes of the loop cell
+};
+
+// summary of each loop, by the index of its StartLoop in ops; the writes of
+// an inner loop are merged into its parent when it ends
+static std::vector<LoopSummary> summarize_loops(const std::vector<Op>& ops, std::vector<int>& loop_at) {
+    std::vector<LoopSummary> loops;
+    std::vector<int> open;      // enclosing loops
+    int pos = 0;
+    loop_at.assign(ops.size(), -1);
+
+    auto write = [&](int i, int offset, bool counted) {
+        if (open.empty()) {
+            return;
+        }
+        LoopSummary& loop = loops[open.back()];
+        int cell = pos + offset - loop.base;
+        loop.writes.push_back(cell);
+        if (cell == 0) {
+            if (counted) {
+                loop.counter.push_back(i);
+            }
+            else {
+                loop.counter_known = false;
+            }
+        }
+    };
+
+    for (int i = 0; i < static_cast<int>(ops.size()); i++) {
+        const Op& op = ops[i];
+        switch (op.type) {
+        case OpType::Move:
+            pos += op.value;
+            break;
+        case OpType::Clear:
+        case OpType::Set:
+        case OpType::Increment:
+            write(i, op.offset, true);
+            break;
+        case OpType::Multiply:
+            write(i, op.offset, true);
+            for (const auto& target : op.targets) {
+                write(i, op.offset + target.offset, false);
+            }
+            break;
+        case OpType::Input:
+            write(i, op.offset, false);
+            break;
+        case OpType::Scan:
+            if (!open.empty()) {
+                loops[open.back()].balanced = false;
+            }
+            break;
+        case OpType::StartLoop:
+            if (!open.empty()) {
+                loops[open.back()].straight = false;
+            }
+            loop_at[i] = static_cast<int>(loops.size());
+            open.push_back(static_cast<int>(loops.size()));
+            loops.emplace_back();
+            loops.back().base = pos;
+            break;
+        case OpType::EndLoop: {
+            LoopSummary& loop = loops[open.back()];
+            open.pop_back();
+            loop.balanced = loop.balanced && pos == loop.base;
+            std::sort(loop.writes.begin(), loop.writes.end());
+            loop.writes.erase(std::unique(loop.writes.begin(), loop.writes.end()), loop.writes.end());
+            if (!open.empty()) {
+                LoopSummary& parent = loops[open.back()];
+                parent.balanced = parent.balanced && loop.balanced;
+                for (int cell : loop.writes) {
+                    cell += loop.base - parent.base;
+                    parent.writes.push_back(cell);
+                    parent.counter_known = parent.counter_known && cell != 0;
+                }
+            }
+            break;
+        }
+        default:
+            break;
+        }
+    }
+    return loops;
+}
+
+// Forward pass over the ops that tracks what is known of the values of
+// cells: an exact value, or that it is 0 or 1. The tape starts all zero, and
+// the current cell is zero after a loop or a scan. A loop that ends on the
+// cell where it started, with no scans, keeps the facts on the cells it does
+// not write; the cells it writes are known at its tests if a few iterations
+// of a body without inner loops repeat their values. A loop whose cell is
+// known to be zero at its EndLoop, or whose cell is known on entry and
+// becomes zero after one iteration, runs at most once, and becomes an If with
+// no back edge. Removes loops, scans, multiplies and clears that cannot
+// change anything, and folds a write of a known value into the previous
+// write of the same cell when nothing read it in between: Clear followed by
+// Increment becomes Set.
+template<typename Cell>
+void BFVM<Cell>::propagate_values() {
+    struct Known {
+        int64_t value;  // 0..Cell max, or -1 if not known
+        int def;        // op in out that wrote the value and is not read since, or -1
+        int64_t prev;   // value before def, or -1 if not known
+        bool boolean;   // the value, if not known, is 0 or 1
+    };
+    // an open loop: how its body was entered, and the facts on the cells it
+    // writes to join at its end; the facts on the other cells hold throughout
+    enum class Entry { Once, Loop, Unbalanced };
+    struct Frame {
+        int start;                      // StartLoop in out
+        Entry entry;
+        const LoopSummary* loop;
+        std::vector<Known> facts;       // of loop->writes: Once: before the loop,
+                                        // Loop: at each test
+    };
+    static const int max_simulated_iterations = 8;
+
+    std::map<int, Known> known;     // by offset from the start of the block
+    bool all_zero = true;           // cells not in known are zero; the block
+                                    // then starts at cell 0, and the cells
+                                    // before it are not known, so that their
+                                    // accesses stay and underflow
+    int block_ptr = 0;              // pointer relative to the start of the block
+
+    std::vector<Op> out;
+    std::vector<bool> removed;      // ops of out folded away
+    std::vector<Frame> frames;      // each enclosing loop
+    std::vector<int> defs;          // cells that may have a def
+    std::vector<int> loop_at;
+    std::vector<LoopSummary> summaries = summarize_loops(ops, loop_at);
+    std::vector<std::pair<int, int>> ifs;   // If in out, and the end of its body
+
+    auto exact = [](int64_t value) -> Known {
+        return { value, -1, -1, false };
+    };
+    const Known unknown = { -1, -1, -1, false };
+    auto fact_in = [&](const std::map<int, Known>& facts, bool zero, int cell) {
+        auto it = facts.find(cell);
+        return it != facts.end() ? it->second : (zero && cell >= 0) ? exact(0) : unknown;
+    };
+    auto fact = [&](int offset) {
+        return fact_in(known, all_zero, block_ptr + offset);
+    };
+    // what holds on either of two paths
+    auto join = [&](const Known& a, const Known& b) {
+        if (a.value >= 0 && a.value == b.value) {
+            return exact(a.value);
+        }
+        auto bit = [](const Known& k) {
+            return k.boolean || k.value == 0 || k.value == 1;
+        };
+        Known k = unknown;
+        k.boolean = bit(a) && bit(b);
+        return k;
+    };
+    // target + factor * source
+    auto add_product = [&](const Known& target, const Known& source, int factor) {
+        Known k = unknown;
+        if (source.value >= 0) {
+            Cell delta = static_cast<Cell>(source.value * factor);
+            if (target.value >= 0) {
+                return exact(static_cast<Cell>(target.value + delta));
+            }
+            k.boolean = target.boolean && delta == 0;
+        }
+        else if (source.boolean && target.value >= 0) {
+            return join(target, exact(static_cast<Cell>(target.value + factor)));
+        }
+        else {
+            k.boolean = target.boolean && static_cast<Cell>(factor) == 0;
+        }
+        return k;
+    };
+
+    auto lookup = [&](int offset) -> Known* {
+        auto it = known.find(block_ptr + offset);
+        if (it == known.end()) {
+            if (!all_zero || block_ptr + offset < 0) {
+                return nullptr;
+            }
+            it = known.insert({ block_ptr + offset, exact(0) }).first;
+        }
+        return it->second.value < 0 ? nullptr : &it->second;
+    };
+    auto forget = [&](int offset) {
+        known[block_ptr + offset] = unknown;
+    };
+    auto new_block = [&](bool zero_cell) {
+        known.clear();
+        defs.clear();
+        all_zero = false;
+        block_ptr = 0;
+        if (zero_cell) {
+            known[0] = exact(0);
+        }
+    };
+    auto push = [&](const Op& op) {
+        out.push_back(op);
+        removed.push_back(false);
+        return static_cast<int>(out.size()) - 1;
+    };
+
+    // the unread write of k now stores value
+    auto rewrite = [&](Known* k, int64_t value) {
+        Op& def = out[k->def];
+        if (value == k->prev) {
+            removed[k->def] = true;     // back to the value before it
+            k->def = -1;
+        }
+        else if (def.type == OpType::Increment && k->prev >= 0) {
+            def.value = static_cast<int>(value - k->prev);
+        }
+        else {
+            def.type = (value == 0) ? OpType::Clear : OpType::Set;
+            def.value = static_cast<int>(value);
+        }
+        k->value = value;
+    };
+    auto define = [&](int offset, int64_t value, int def, int64_t prev) {
+        known[block_ptr + offset] = { value, def, prev, false };
+        if (def >= 0) {
+            defs.push_back(block_ptr + offset);
+        }
+    };
+
+    // the loop cell after one iteration entered with it at value
+    auto runs_once = [&](const LoopSummary& loop, int64_t value) {
+        if (!loop.counter_known) {
+            return false;
+        }
+        for (int i : loop.counter) {
+            const Op& op = ops[i];
+            if (op.type == OpType::Increment) {
+                value = static_cast<Cell>(value + op.value);
+            }
+            else if (op.type == OpType::Set) {
+                value = static_cast<Cell>(op.value);
+            }
+            else {
+                value = 0;      // Clear, or the source of a Multiply
+            }
+        }
+        return value == 0;
+    };
+
+    // facts at each test of a balanced loop starting at ops[start] on the
+    // cells it writes: the values they take over the first iterations, if
+    // they repeat, else nothing
+    auto loop_tests = [&](const LoopSummary& loop, int start) {
+        std::vector<std::vector<Known>> tests;
+        std::map<int, Known> state;     // the cells written so far
+        auto get = [&](int cell) {
+            auto it = state.find(cell);
+            return it != state.end() ? it->second : fact_in(known, all_zero, cell);
+        };
+        bool repeats = false;
+        for (int n = 0; loop.straight && n < max_simulated_iterations && !repeats; n++) {
+            std::vector<Known> values;
+            for (int cell : loop.writes) {
+                values.push_back(get(block_ptr + cell));
+            }
+            for (const auto& test : tests) {
+                repeats = repeats || std::equal(test.begin(), test.end(), values.begin(),
+                    [](const Known& a, const Known& b) {
+                        return a.value == b.value && a.boolean == b.boolean;
+                    });
+            }
+            if (!repeats) {
+                tests.push_back(values);
+            }
+            if (repeats || get(block_ptr).value == 0) {
+                repeats = true;         // no further iteration
+                break;
+            }
+
+            int pos = block_ptr;
+            for (int j = start + 1; ops[j].type != OpType::EndLoop; j++) {
+                const Op& op = ops[j];
+                switch (op.type) {
+                case OpType::Move:
+                    pos += op.value;
+                    break;
+                case OpType::Clear:
+                case OpType::Set:
+                    state[pos + op.offset] = exact(static_cast<Cell>(op.type == OpType::Set ? op.value : 0));
+                    break;
+                case OpType::Increment:
+                    state[pos + op.offset] = add_product(get(pos + op.offset), exact(1), op.value);
+                    break;
+                case OpType::Multiply: {
+                    Known source = get(pos + op.offset);
+                    for (const auto& target : op.targets) {
+                        int cell = pos + op.offset + target.offset;
+                        state[cell] = add_product(get(cell), source, target.factor);
+                    }
+                    state[pos + op.offset] = exact(0);
+                    break;
+                }
+                case OpType::Input:
+                    state[pos + op.offset] = unknown;
+                    break;
+                default:
+                    break;
+                }
+            }
+        }
+
+        std::vector<Known> facts;
+        for (size_t c = 0; c < loop.writes.size(); c++) {
+            Known k = unknown;
+            if (repeats) {
+                k = tests[0][c];
+                for (const auto& test : tests) {
+                    k = join(k, test[c]);
+                }
+            }
+            facts.push_back(k);
+        }
+        return facts;
+    };
+
+    for (size_t i = 0; i < ops.size(); i++) {
+        const Op& op = ops[i];
+        switch (op.type) {
+        case OpType::Move:
+            push(op);
+            block_ptr += op.value;
+            break;
+
+        case OpType::Clear:
+        case OpType::Set: {
+            int64_t value = (op.type == OpType::Clear) ? 0 : static_cast<Cell>(op.value);
+            Known* k = lookup(op.offset);
+            if (k != nullptr && k->value == value) {
+                break;      // already holds the value
+            }
+            if (k != nullptr && k->def >= 0) {
+                rewrite(k, value);
+                break;
+            }
+            Op set = op;
+            set.type = (value == 0) ? OpType::Clear : OpType::Set;
+            set.value = static_cast<int>(value);
+            int64_t prev = (k != nullptr) ? k->value : -1;
+            define(op.offset, value, push(set), prev);
+            break;
+        }
+        case OpType::Increment: {
+            Known* k = lookup(op.offset);
+            if (k == nullptr) {
+                push(op);
+                forget(op.offset);
+                break;
+            }
+            int64_t value = static_cast<Cell>(k->value + op.value);
+            if (k->def >= 0) {
+                rewrite(k, value);      // fold into the unread write
+            }
+            else {
+                int64_t prev = k->value;
+                define(op.offset, value, push(op), prev);
+            }
+            break;
+        }
+        case OpType::Multiply: {
+            Known* k = lookup(op.offset);
+            if (k != nullptr && k->value == 0) {
+                break;      // nothing to multiply
+            }
+            push(op);
+            Known source = fact(op.offset);
+            for (const auto& target : op.targets) {
+                int offset = op.offset + target.offset;
+                known[block_ptr + offset] = add_product(fact(offset), source, target.factor);
+            }
+            define(op.offset, 0, -1, -1);
+            break;
+        }
+        case OpType::Scan: {
+            Known* k = lookup(0);
+            if (k != nullptr && k->value == 0) {
+                break;      // already on a zero cell
+            }
+            push(op);
+            new_block(true);
+            break;
+        }
+        case OpType::StartLoop: {
+            Known* k = lookup(0);
+            if (k != nullptr && k->value == 0) {
+                // dead loop: skip to the matching EndLoop
+                int depth = 0;
+                for (; i < ops.size(); i++) {
+                    if (ops[i].type == OpType::StartLoop) {
+                        depth++;
+                    }
+                    else if (ops[i].type == OpType::EndLoop && --depth == 0) {
+                        break;
+                    }
+                }
+                break;
+            }
+            const LoopSummary& loop = summaries[loop_at[i]];
+            Known cell = fact(0);
+            int64_t first = (cell.value > 0) ? cell.value : cell.boolean ? 1 : -1;   // on entry
+            for (int c : defs) {
+                auto it = known.find(c);
+                if (it != known.end()) {
+                    it->second.def = -1;    // the loop may read it
+                }
+            }
+            defs.clear();
+
+            if (loop.balanced && first > 0 && runs_once(loop, first)) {
+                Frame frame = { push(op), Entry::Once, &loop, {} };
+                for (int c : loop.writes) {
+                    frame.facts.push_back(fact(c));
+                }
+                frames.push_back(std::move(frame));
+                define(0, first, -1, -1);
+            }
+            else if (loop.balanced) {
+                frames.push_back({ push(op), Entry::Loop, &loop, loop_tests(loop, static_cast<int>(i)) });
+                for (size_t c = 0; c < loop.writes.size(); c++) {
+                    known[block_ptr + loop.writes[c]] = frames.back().facts[c];
+                }
+                if (fact(0).boolean) {
+                    define(0, 1, -1, -1);   // nonzero in the body
+                }
+            }
+            else {
+                frames.push_back({ push(op), Entry::Unbalanced, &loop, {} });
+                new_block(false);
+            }
+            break;
+        }
+        case OpType::EndLoop: {
+            Frame frame = std::move(frames.back());
+            frames.pop_back();
+            Known* k = lookup(0);
+            if (frame.entry == Entry::Once || (k != nullptr && k->value == 0)) {
+                out[frame.start].type = OpType::If;
+                ifs.push_back({ frame.start, static_cast<int>(out.size()) });
+            }
+            else {
+                push(op);
+            }
+
+            const std::vector<int>& writes = frame.loop->writes;
+            if (frame.entry == Entry::Once) {
+                // skipped with the facts from before the loop, or run once
+                for (size_t c = 0; c < writes.size(); c++) {
+                    Known skipped = (writes[c] == 0) ? exact(0) : frame.facts[c];
+                    known[block_ptr + writes[c]] = join(skipped, fact(writes[c]));
+                }
+            }
+            else if (frame.entry == Entry::Loop) {
+                for (size_t c = 0; c < writes.size(); c++) {
+                    known[block_ptr + writes[c]] = frame.facts[c];
+                }
+                define(0, 0, -1, -1);
+            }
+            else {
+                new_block(true);
+            }
+            break;
+        }
+        case OpType::Input:
+            push(op);
+            forget(op.offset);
+            break;
+
+        case OpType::Output: {
+            push(op);
+            Known* k = lookup(op.offset);
+            if (k != nullptr) {
+                k->def = -1;    // the value is read
+            }
+            break;
+        }
+        default:
+            error("Invalid op");
+        }
+    }
+
+    // index in ops of each op of out, and of the end of out
+    std::vector<int> kept(out.size() + 1);
+    ops.clear();
+    for (size_t i = 0; i < out.size(); i++) {
+        kept[i] = static_cast<int>(ops.size());
+        if (!removed[i]) {
+            ops.push_back(std::move(out[i]));
+        }
+    }
+    kept[out.size()] = static_cast<int>(ops.size());
+    for (const auto& body : ifs) {
+        ops[kept[body.first]].value = kept[body.second] - kept[body.first] - 1;
+    }
+}
+
+// Straight-line bodies of Ifs, with no loops, Ifs or scans, become offset
+// addressed ops with at most one Move at the end. When such a body leaves
+// the pointer where it found it, a Move before the If is carried past the
+// body, into the offsets of the If and of its body, where it can merge with
+// the Move after the If.
+template<typename Cell>
+void BFVM<Cell>::flatten_ifs() {
+    std::vector<Op> out;
+    std::vector<std::pair<int, int>> open;  // If in out, and the op that ends its body
+    int block_start = 0;    // out from here on is at the current nesting level
+    int carried = -1;       // Move in out carried past an If, or -1
+
+    // moves of out that can still merge with a following move
+    auto is_free_move = [&](int k) {
+        return k >= block_start && out[k].type == OpType::Move;
+    };
+    auto close_ifs = [&](int i) {
+        while (!open.empty() && open.back().second == i) {
+            int k = open.back().first;
+            out[k].value = static_cast<int>(out.size()) - k - 1;
+            open.pop_back();
+            block_start = static_cast<int>(out.size());
+        }
+    };
+
+    for (int i = 0; i < static_cast<int>(ops.size()); i++) {
+        const Op& op = ops[i];
+        if (op.type == OpType::Move && carried >= 0 && carried == static_cast<int>(out.size()) - 1 &&
+                is_free_move(carried)) {
+            out[carried].value += op.value;
+            if (out[carried].value == 0) {
+                out.pop_back();
+            }
+            carried = -1;
+            close_ifs(i);
+            continue;
+        }
+        carried = -1;
+
+        if (op.type == OpType::If) {
+            int end = i + op.value;
+            bool straight = true;
+            int net = 0;
+            for (int k = i + 1; k <= end; k++) {
+                OpType type = ops[k].type;
+                if (type == OpType::StartLoop || type == OpType::EndLoop ||
+                        type == OpType::Scan || type == OpType::If) {
+                    straight = false;
+                    break;
+                }
+                if (type == OpType::Move) {
+                    net += ops[k].value;
+                }
+            }
+
+            if (straight) {
+                // carry the Move before the If past a balanced body
+                int shift = 0;
+                int last = static_cast<int>(out.size()) - 1;
+                Op carry(OpType::Move);
+                if (net == 0 && last >= 0 && is_free_move(last) &&
+                        wrap_cell<Cell>(op.offset + out[last].value) == op.offset + out[last].value) {
+                    carry = out[last];
+                    shift = carry.value;
+                    out.pop_back();
+                }
+
+                int k = static_cast<int>(out.size());
+                out.push_back(op);
+                out[k].offset += shift;
+                int pos = shift;
+                for (int b = i + 1; b <= end; b++) {
+                    if (ops[b].type == OpType::Move) {
+                        pos += ops[b].value;
+                    }
+                    else {
+                        out.push_back(ops[b]);
+                        out.back().offset += pos;
+                    }
+                }
+                if (pos != shift) {
+                    Op move(OpType::Move, pos - shift);
+                    move.source = ops[end].source;
+                    out.push_back(move);
+                }
+                out[k].value = static_cast<int>(out.size()) - k - 1;
+                block_start = static_cast<int>(out.size());
+                if (shift != 0) {
+                    carried = static_cast<int>(out.size());
+                    out.push_back(carry);
+                }
+                i = end;
+                close_ifs(i);
+                continue;
+            }
+
+            open.push_back({ static_cast<int>(out.size()), end });
+            out.push_back(op);
+            block_start = static_cast<int>(out.size());
+            close_ifs(i);       // an empty body
+            continue;
+        }
+
+        out.push_back(op);
+        if (op.type == OpType::StartLoop || op.type == OpType::EndLoop) {
+            block_start = static_cast<int>(out.size());
+        }
+        close_ifs(i);
+    }
+
+    ops = std::move(out);
+}
+
+template<typename Cell>
+void BFVM<Cell>::compute_jumps() {
+    // comppute the jumps
+    jumps.clear();
+    jumps.resize(ops.size(), -1);
+    std::vector<int> stack;
+    stack.reserve(ops.size());
+    for (int i = 0; i < static_cast<int>(ops.size()); i++) {
+        if (ops[i].type == OpType::StartLoop) {
+            stack.push_back(i);
+        }
+        else if (ops[i].type == OpType::EndLoop) {
+            if (stack.empty()) {
+                error("Unmatched ']'");
+            }
+            int open = stack.back();
+            stack.pop_back();
+            jumps[open] = i;
+            jumps[i] = open;
+        }
+        else if (ops[i].type == OpType::If) {
+            jumps[i] = i + ops[i].value;    // the last op of the body
+        }
+    }
+    if (!stack.empty()) {
+        error("Unmatched '['");
+    }
+}
+
+template<typename Cell>
+void BFVM<Cell>::encode_instrs() {
+    instrs.clear();
+    multiply_table.clear();
+    instrs.reserve(ops.size());
+
+    for (int i = 0; i < static_cast<int>(ops.size()); i++) {
+        const Op& op = ops[i];
+        Instr<Cell> instr = { op.type, static_cast<Cell>(op.value), op.offset };
+        switch (op.type) {
+        case OpType::Move:
+        case OpType::Scan:
+            instr.value = 0;
+            instr.arg = op.value;
+            break;
+        case OpType::StartLoop:
+        case OpType::EndLoop:
+            instr.arg = jumps[i];
+            break;
+        case OpType::If:
+            instr.value = static_cast<Cell>(op.offset);
+            instr.arg = jumps[i];
+            break;
+        case OpType::Multiply:
+            instr.arg = static_cast<int32_t>(multiply_table.size());
+            multiply_table.push_back({ op.offset, static_cast<int>(op.targets.size()) });
+            for (const auto& target : op.targets) {
+                multiply_table.push_back({ op.offset + target.offset, target.factor });
+            }
+            break;
+        default:
+            break;
+        }
+        instrs.push_back(instr);
+    }
+}
+
+template<typename Cell>
+void BFVM<Cell>::dump_state(std::ostream& out) const {
+    // Find the last non-zero cell
+    int last_nz = 0;
+    for (int i = static_cast<int>(tape.used_size()); i-- > 0; ) {
+        if (tape[i] != 0) {
+            last_nz = i;
+            break;
+        }
+    }
+
+    // Ensure we still show the pointer cell even if it's beyond last_nz
+    int last_to_show = std::max(last_nz, ptr);
+    if (last_to_show >= static_cast<int>(tape.size())) {
+        last_to_show = static_cast<int>(tape.size()) - 1;
+    }
+
+    out << "Tape:";
+    for (int i = 0; i <= last_to_show; ++i) {
+        out << std::setw(3) << static_cast<unsigned long>(tape[i]) << ' ';
+    }
+    out << "\n     ";
+    if (ptr > 0) {
+        out << std::string(ptr * 4, ' ');
+    }
+    out << "^^^" << " (ptr=" << ptr << ")\n\n";
+}
+
+// runtime support of the C translation: same checks and tape growth as BFVM::run()
+static const char* c_includes = R"(/* generated by bf --emit-c */
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+)";
+
+static const char* c_prelude = R"(
+static cell* tape;
+static long tape_size;
+
+static void error(const char* msg) {
+    fflush(stdout);
+    fprintf(stderr, "Error: %s\n", msg);
+    exit(EXIT_FAILURE);
+}
+
+/* grow the tape to include cell pos, return pointer to it */
+static cell* grow(long pos) {
+    long new_size = tape_size;
+    while (new_size <= pos) {
+        new_size *= 2;
+    }
+    tape = (cell*)realloc(tape, new_size * sizeof(cell));
+    if (tape == NULL) {
+        error("Out of memory");
+    }
+    memset(tape + tape_size, 0, (new_size - tape_size) * sizeof(cell));
+    tape_size = new_size;
+    return tape + pos;
+}
+
+/* check that cell p[offset] exists, return p after a possible reallocation */
+static inline cell* reach(cell* p, long offset) {
+    long pos = (long)(p - tape);
+    if (pos + offset < 0) {
+        error("Tape pointer underflow");
+    }
+    if (pos + offset >= tape_size) {
+        grow(pos + offset);
+    }
+    return tape + pos;
+}
+
+static inline cell* move(cell* p, long offset) {
+    return reach(p, offset) + offset;
+}
+
+static inline cell* scan_right(cell* p, long stride) {
+    cell* z;
+    if (stride != 1 || sizeof(cell) != 1) {
+        while (*p != 0) {
+            p = move(p, stride);
+        }
+        return p;
+    }
+    z = (cell*)memchr(p, 0, tape_size - (p - tape));
+    return z != NULL ? z : grow(tape_size);
+}
+
+static inline cell* scan_left(cell* p, long stride) {
+    cell* z;
+    if (stride != 1 || sizeof(cell) != 1) {
+        while (*p != 0) {
+            p = move(p, -stride);
+        }
+        return p;
+    }
+#ifdef __GLIBC__
+    z = (cell*)memrchr(tape, 0, (p - tape) + 1);
+#else
+    z = p;
+    while (z >= tape && *z != 0) {
+        z--;
+    }
+    if (z < tape) {
+        z = NULL;
+    }
+#endif
+    if (z == NULL) {
+        error("Tape pointer underflow");
+    }
+    return z;
+}
+
+)";
+
+static const char* c_main_begin = R"(int main(void) {
+    cell* p;
+    tape_size = 4096;
+    tape = (cell*)calloc(tape_size, sizeof(cell));
+    if (tape == NULL) {
+        error("Out of memory");
+    }
+    p = tape;
+
+)";
+
+static const char* c_main_end = R"(
+    fflush(stdout);
+    free(tape);
+    return EXIT_SUCCESS;
+}
+)";
+
+// ops per generated C function; keeps huge programs within reach of the
+// host compiler's optimizer
+static const int c_function_ops = 1000;
+
+template<typename Cell>
+void BFVM<Cell>::emit_c(std::ostream& out) const {
+    std::vector<std::string> functions;
+    std::ostringstream body;
+    emit_c_ops(body, 0, static_cast<int>(ops.size()), 1, functions);
+
+    out << c_includes << "typedef uint" << (8 * sizeof(Cell)) << "_t cell;\n" << c_prelude;
+    for (const auto& function : functions) {
+        out << function;
+    }
+    out << c_main_begin << body.str() << c_main_end;
+}
+
+// emits ops[begin, end); long ranges are split into helper functions
+// 'static cell* fN(cell* p)' appended to functions
+template<typename Cell>
+void BFVM<Cell>::emit_c_ops(std::ostream& out, int begin, int end, int indent,
+                      std::vector<std::string>& functions) const {
+    auto line = [&](const std::string& text) {
+        out << std::string(indent * 4, ' ') << text << "\n";
+    };
+
+    auto outline = [&](int from, int to, bool is_block) {
+        std::ostringstream func;
+        std::string name = "f" + std::to_string(from);
+        func << "static cell* " << name << "(cell* p) {\n";
+        if (is_block && ops[from].type == OpType::If) {
+            int offset = ops[from].offset;
+            func << "    p = reach(p, " << offset << ");\n";
+            func << "    if (p[" << offset << "] != 0) {\n";
+            emit_c_ops(func, from + 1, to, 2, functions);
+            func << "    }\n";
+        }
+        else if (is_block) {
+            func << "    while (p[0] != 0) {\n";
+            emit_c_ops(func, from + 1, to - 1, 2, functions);
+            func << "    }\n";
+        }
+        else {
+            emit_c_ops(func, from, to, 1, functions);
+        }
+        func << "    return p;\n}\n\n";
+        functions.push_back(func.str());
+        line("p = " + name + "(p);");
+    };
+
+    if (end - begin > c_function_ops) {
+        // group top-level items of the range in chunks of about c_function_ops
+        int chunk = begin;
+        int i = begin;
+        while (i < end) {
+            bool block = (ops[i].type == OpType::StartLoop || ops[i].type == OpType::If);
+            int next = block ? jumps[i] + 1 : i + 1;
+            if (next - i > c_function_ops) {
+                if (chunk < i) {
+                    outline(chunk, i, false);
+                }
+                outline(i, next, true);
+                chunk = next;
+            }
+            else if (next - chunk > c_function_ops) {
+                outline(chunk, i, false);
+                chunk = i;
+            }
+            i = next;
+        }
+        if (chunk < end) {
+            outline(chunk, end, false);
+        }
+        return;
+    }
+
+    // cells [p+reach_lo, p+reach_hi] are known to exist until p moves
+    int reach_lo = 0;
+    int reach_hi = 0;
+    auto reach = [&](int offset) {
+        if (offset < reach_lo || offset > reach_hi) {
+            line("p = reach(p, " + std::to_string(offset) + ");");
+            reach_lo = std::min(reach_lo, offset);
+            reach_hi = std::max(reach_hi, offset);
+        }
+    };
+    auto cell = [&](int offset) {
+        return "p[" + std::to_string(offset) + "]";
+    };
+    std::vector<int> ifs;   // last op of the body of each open If
+
+    for (int i = begin; i < end; i++) {
+        const Op& op = ops[i];
+        switch (op.type) {
+        case OpType::Move:
+            line("p = move(p, " + std::to_string(op.value) + ");");
+            reach_lo = reach_hi = 0;
+            break;
+
+        case OpType::Clear:
+            reach(op.offset);
+            line(cell(op.offset) + " = 0;");
+            break;
+
+        case OpType::Set:
+            reach(op.offset);
+            line(cell(op.offset) + " = " + std::to_string(op.value) + ";");
+            break;
+
+        case OpType::Increment:
+            reach(op.offset);
+            line(cell(op.offset) + " += " + std::to_string(op.value) + ";");
+            break;
+
+        case OpType::Multiply: {
+            int min_offset = 0;
+            int max_offset = 0;
+            for (const auto& target : op.targets) {
+                min_offset = std::min(min_offset, target.offset);
+                max_offset = std::max(max_offset, target.offset);
+            }
+
+            reach(op.offset);
+            line("if (" + cell(op.offset) + " != 0) {");
+            indent++;
+            int saved_lo = reach_lo;
+            int saved_hi = reach_hi;
+            reach(op.offset + min_offset);
+            reach(op.offset + max_offset);
+            for (const auto& target : op.targets) {
+                line(cell(op.offset + target.offset) + " += " + cell(op.offset) + " * " +
+                     std::to_string(target.factor) + ";");
+            }
+            line(cell(op.offset) + " = 0;");
+            reach_lo = saved_lo;
+            reach_hi = saved_hi;
+            indent--;
+            line("}");
+            break;
+        }
+        case OpType::Scan:
+            if (op.value > 0) {
+                line("p = scan_right(p, " + std::to_string(op.value) + ");");
+            }
+            else {
+                line("p = scan_left(p, " + std::to_string(-op.value) + ");");
+            }
+            reach_lo = reach_hi = 0;
+            break;
+
+        case OpType::StartLoop:
+            line("while (p[0] != 0) {");
+            indent++;
+            reach_lo = reach_hi = 0;
+            break;
+
+        case OpType::EndLoop:
+            indent--;
+            line("}");
+            reach_lo = reach_hi = 0;
+            break;
+
+        case OpType::Input:
+            reach(op.offset);
+            line(cell(op.offset) + " = (cell)getchar();");
+            break;
+
+        case OpType::Output:
+            reach(op.offset);
+            line("putchar(" + cell(op.offset) + ");");
+            break;
+
+        case OpType::If:
+            reach(op.offset);
+            line("if (" + cell(op.offset) + " != 0) {");
+            indent++;
+            ifs.push_back(jumps[i]);
+            break;
+
+        default:
+            error("Invalid op");
+        }
+
+        while (!ifs.empty() && ifs.back() == i) {
+            ifs.pop_back();
+            indent--;
+            line("}");
+            reach_lo = reach_hi = 0;
+        }
+    }
+}
+
+template<typename Cell>
+void BFVM<Cell>::check_ptr(int p) {
+    if (p < 0) {
+        error("Tape pointer underflow");
+    }
+    else if (p >= static_cast<int>(tape.size())) {
+        tape.resize(p + 1);
+    }
+}
+
+template<typename Cell>
+template<bool Checked>
+void BFVM<Cell>::multiply(const Op& op, int p) {
+    p += op.offset;
+    Cell origin_val = cell<Checked>(p);
+    if (origin_val == 0) {
+        return;    // nothing to do
+    }
+
+    for (const auto& target : op.targets) {
+        Cell& target_cell = cell<Checked>(p + target.offset);
+        target_cell = static_cast<Cell>(target_cell + (origin_val * target.factor));
+    }
+
+    tape[p] = 0;
+}
+
+template<typename Cell>
+template<bool Checked>
+void BFVM<Cell>::multiply(const MultiplyTarget* entry, int p) {
+    Cell origin_val = cell<Checked>(p + entry->offset);
+    if (origin_val == 0) {
+        return;    // nothing to do
+    }
+
+    const MultiplyTarget* end = entry + 1 + entry->factor;
+    for (const MultiplyTarget* target = entry + 1; target != end; target++) {
+        Cell& target_cell = cell<Checked>(p + target->offset);
+        target_cell = static_cast<Cell>(target_cell + (origin_val * target->factor));
+    }
+
+    tape[p + entry->offset] = 0;
+}
+
+// Zero search for Scan ops. On byte cells stride 1 uses memchr/memrchr;
+// other strides compare 16 cells at a time with SSE2 and mask out the lanes
+// that are not a multiple of the stride away from the start. Wider cells
+// take the plain loops.
+
+// index of the first zero at p, p+stride, ... below n, or else the first
+// of those indexes that is >= n
+template<typename Cell>
+static size_t find_zero_right(const Cell* cells, size_t n, size_t p, int stride) {
+    size_t q = p;
+    while (q < n && cells[q] != 0) {
+        q += stride;
+    }
+    return q;
+}
+
+// index of the first zero at p, p-stride, ...; negative if none
+template<typename Cell>
+static long find_zero_left(const Cell* cells, size_t p, int stride) {
+    long q = static_cast<long>(p);
+    while (q >= 0 && cells[q] != 0) {
+        q -= stride;
+    }
+    return q;
+}
+
+static size_t find_zero_right(const uint8_t* cells, size_t n, size_t p, int stride) {
+    if (stride == 1) {
+        const void* found = std::memchr(cells + p, 0, n - p);
+        return found != nullptr ? static_cast<const uint8_t*>(found) - cells : n;
+    }
+
+    size_t i = p;
+    int phase = 0;      // (i - p) % stride
+#if defined(__SSE2__)
+    if (stride <= 16) {
+        // masks[phase]: lanes j where (j + phase) % stride == 0
+        uint32_t masks[16];
+        for (int ph = 0; ph < stride; ph++) {
+            masks[ph] = 0;
+            for (int j = (stride - ph) % stride; j < 16; j += stride) {
+                masks[ph] |= 1u << j;
+            }
+        }
+
+        const __m128i zero = _mm_setzero_si128();
+        while (i + 16 <= n) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cells + i));
+            uint32_t hit = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero))) &
+                           masks[phase];
+            if (hit != 0) {
+                return i + __builtin_ctz(hit);
+            }
+            i += 16;
+            phase = (phase + 16) % stride;
+        }
+    }
+#endif
+
+    size_t q = i + (stride - phase) % stride;
+    while (q < n && cells[q] != 0) {
+        q += stride;
+    }
+    return q;
+}
+
+static long find_zero_left(const uint8_t* cells, size_t p, int stride) {
+    if (stride == 1) {
+#if defined(__GLIBC__)
+        const void* found = memrchr(cells, 0, p + 1);
+        return found != nullptr ? static_cast<const uint8_t*>(found) - cells : -1;
+#else
+        long q = static_cast<long>(p);
+        while (q >= 0 && cells[q] != 0) {
+            q--;
+        }
+        return q;
+#endif
+    }
+
+    long top = static_cast<long>(p);     // block is [top-15, top]
+    int phase = 0;                       // (p - top) % stride
+#if defined(__SSE2__)
+    if (stride <= 16) {
+        // masks[phase]: lanes j where (15 - j + phase) % stride == 0
+        uint32_t masks[16];
+        for (int ph = 0; ph < stride; ph++) {
+            masks[ph] = 0;
+            for (int j = 15 - (stride - ph) % stride; j >= 0; j -= stride) {
+                masks[ph] |= 1u << j;
+            }
+        }
+
+        const __m128i zero = _mm_setzero_si128();
+        while (top >= 15) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cells + top - 15));
+            uint32_t hit = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero))) &
+                           masks[phase];
+            if (hit != 0) {
+                return top - 15 + (31 - __builtin_clz(hit));
+            }
+            top -= 16;
+            phase = (phase + 16) % stride;
+        }
+    }
+#endif
+
+    long q = top - (stride - phase) % stride;
+    while (q >= 0 && cells[q] != 0) {
+        q -= stride;
+    }
+    return q;
+}
+
+// the first read of tape[p] also faults on a guarded tape if a preceding
+// unchecked move left the pointer out of bounds
+template<typename Cell>
+int BFVM<Cell>::scan(int stride, int p) {
+    if (tape[p] == 0) {
+        return p;
+    }
+
+    if (stride > 0) {
+        size_t q = find_zero_right(tape.data(), tape.size(), p, stride);
+        if (q >= tape.size()) {
+            check_ptr(static_cast<int>(q));     // expand the tape
+        }
+        return static_cast<int>(q);
+    }
+    else {
+        long q = find_zero_left(tape.data(), p, -stride);
+        if (q < 0) {
+            error("Tape pointer underflow");
+        }
+        return static_cast<int>(q);
+    }
+}
+
+// largest distance below and above the pointer a single op can reach
+template<typename Cell>
+void BFVM<Cell>::reach_of_ops(int& below, int& above) const {
+    below = above = 1;
+    auto extend = [&](int offset) {
+        below = std::max(below, -offset);
+        above = std::max(above, offset);
+    };
+
+    for (const auto& op : ops) {
+        switch (op.type) {
+        case OpType::Move:
+            extend(op.value);
+            break;
+        case OpType::Scan:
+            extend(op.value);
+            extend(-op.value);
+            break;
+        case OpType::Multiply:
+            extend(op.offset);
+            for (const auto& target : op.targets) {
+                extend(op.offset + target.offset);
+            }
+            break;
+        default:
+            extend(op.offset);
+        }
+    }
+}
+
+// largest tape for which static_tape_extent() reports a bound
+static const long max_static_extent = 1L << 20;
+
+// Cells reachable by the program when its pointer range is static: each
+// loop body moves the pointer by a net zero, so that every op runs at the
+// same position on each pass, and no Scan moves it by a data dependent
+// amount. A pre-executed start state is part of a run from the start, so
+// the bound holds for it too. 0 if unbounded or out of range.
+template<typename Cell>
+size_t BFVM<Cell>::static_tape_extent() const {
+    long pos = 0, low = 0, high = 0;
+    std::vector<long> loop_pos;     // pointer at each enclosing StartLoop
+    std::vector<std::pair<int, long>> if_pos;   // last op of the body and pointer of each open If
+    auto reach = [&](long offset) {
+        low = std::min(low, pos + offset);
+        high = std::max(high, pos + offset);
+    };
+
+    for (int i = 0; i < static_cast<int>(ops.size()); i++) {
+        const Op& op = ops[i];
+        switch (op.type) {
+        case OpType::Move:
+            pos += op.value;
+            reach(0);
+            break;
+        case OpType::Scan:
+            return 0;
+        case OpType::Multiply:
+            reach(op.offset);
+            for (const auto& target : op.targets) {
+                reach(op.offset + target.offset);
+            }
+            break;
+        case OpType::StartLoop:
+            reach(0);
+            loop_pos.push_back(pos);
+            break;
+        case OpType::EndLoop:
+            if (loop_pos.empty() || loop_pos.back() != pos) {
+                return 0;
+            }
+            loop_pos.pop_back();
+            break;
+        case OpType::If:
+            reach(op.offset);
+            if_pos.push_back({ jumps[i], pos });
+            break;
+        default:
+            reach(op.offset);
+        }
+        for (; !if_pos.empty() && if_pos.back().first == i; if_pos.pop_back()) {
+            if (if_pos.back().second != pos) {
+                return 0;
+            }
+        }
+        if (high >= max_static_extent) {
+            return 0;
+        }
+    }
+
+    // an underflow is left to the checked loops to report
+    if (low < 0) {
+        return 0;
+    }
+    return static_cast<size_t>(high + 1);
+}
+
+// Checkpoint file, in native byte order:
+//   header      magic "BFCK", version, cell width in bits, 0
+//               hash of the ops, pc, ptr, input offset, output offset and
+//               tape size in cells, all uint64_t
+//   blocks      index, then the cells of each block of checkpoint_block
+//               bytes that holds a non-zero cell
+//   end         index UINT64_MAX
+static const char checkpoint_magic[4] = { 'B', 'F', 'C', 'K' };
+static const uint32_t checkpoint_version = 1;
+static const size_t checkpoint_block = 4096;
+static const uint64_t checkpoint_end = UINT64_MAX;
+
+// count of SIGUSR1 signals, polled by the run loops on loop back edges;
+// each machine checkpoints when the count differs from the one it saw last,
+// so that one signal reaches every machine running
+static std::atomic<unsigned> checkpoint_signals(0);
+
+#ifdef BF_HAVE_CHECKPOINT_SIGNALS
+// the SIGUSR1 action of the process before the first run with checkpoints,
+// restored when the last one returns; runs on other threads overlap
+static std::mutex checkpoint_handler_mutex;
+static int checkpoint_handler_users = 0;
+static struct sigaction previous_usr1_action;
+
+static void checkpoint_signal_handler(int sig) {
+    (void)sig;
+    checkpoint_signals.fetch_add(1, std::memory_order_relaxed);
+}
+#endif
+
+// the SIGUSR1 handler, installed for the duration of a run with checkpoints
+class CheckpointHandler {
+public:
+    CheckpointHandler() = default;
+    CheckpointHandler(const CheckpointHandler&) = delete;
+    CheckpointHandler& operator=(const CheckpointHandler&) = delete;
+    ~CheckpointHandler();
+
+    void install();
+
+private:
+    bool installed = false;
+};
+
+void CheckpointHandler::install() {
+#ifdef BF_HAVE_CHECKPOINT_SIGNALS
+    std::lock_guard<std::mutex> lock(checkpoint_handler_mutex);
+    if (checkpoint_handler_users == 0) {
+        struct sigaction action;
+        std::memset(&action, 0, sizeof(action));
+        action.sa_handler = checkpoint_signal_handler;
+        action.sa_flags = SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        if (sigaction(SIGUSR1, &action, &previous_usr1_action) != 0) {
+            return;
+        }
+    }
+    checkpoint_handler_users++;
+    installed = true;
+#endif
+}
+
+CheckpointHandler::~CheckpointHandler() {
+#ifdef BF_HAVE_CHECKPOINT_SIGNALS
+    if (installed) {
+        std::lock_guard<std::mutex> lock(checkpoint_handler_mutex);
+        if (--checkpoint_handler_users == 0) {
+            sigaction(SIGUSR1, &previous_usr1_action, nullptr);
+        }
+    }
+#endif
+}
+
+// FNV-1a over the ops, so that a checkpoint only resumes the program and
+// options that produced it
+template<typename Cell>
+uint64_t BFVM<Cell>::ops_hash() const {
+    uint64_t hash = 14695981039346656037ull;
+    auto mix = [&](int64_t value) {
+        for (int i = 0; i < 8; i++) {
+            hash ^= static_cast<uint8_t>(value >> (8 * i));
+            hash *= 1099511628211ull;
+        }
+    };
+
+    mix(sizeof(Cell));
+    for (const auto& op : ops) {
+        mix(static_cast<int64_t>(op.type));
+        mix(op.value);
+        mix(op.offset);
+        for (const auto& target : op.targets) {
+            mix(target.offset);
+            mix(target.factor);
+        }
+    }
+    return hash;
+}
+
+// the interval is timed by each machine on its own, with no process timer
+template<typename Cell>
+void BFVM<Cell>::start_checkpoints() {
+    checkpoints_started = true;
+    checkpoint_signals_seen = checkpoint_signals.load(std::memory_order_relaxed);
+    next_checkpoint = std::chrono::steady_clock::now() +
+                      std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                          std::chrono::duration<double>(checkpoint_interval));
+}
+
+template<typename Cell>
+bool BFVM<Cell>::checkpoint_due() const {
+    return checkpoints_started &&
+           (checkpoint_signals.load(std::memory_order_relaxed) != checkpoint_signals_seen ||
+            (checkpoint_interval > 0 && std::chrono::steady_clock::now() >= next_checkpoint));
+}
+
+// writes the state before executing op at_pc with the pointer at p; the
+// file is replaced only once the new one is complete
+template<typename Cell>
+void BFVM<Cell>::write_checkpoint(int p, int at_pc) {
+    start_checkpoints();
+    program_output.flush();
+
+    std::string temp_file = checkpoint_file + ".tmp";
+    std::ofstream out(temp_file, std::ios::binary);
+    auto put = [&](const void* data, size_t size) {
+        out.write(static_cast<const char*>(data), size);
+    };
+    auto put32 = [&](uint32_t value) {
+        put(&value, sizeof(value));
+    };
+    auto put64 = [&](uint64_t value) {
+        put(&value, sizeof(value));
+    };
+
+    size_t size = std::max(tape.used_size(), static_cast<size_t>(p) + 1);
+    size = std::min(size, tape.size());
+
+    put(checkpoint_magic, sizeof(checkpoint_magic));
+    put32(checkpoint_version);
+    put32(8 * sizeof(Cell));
+    put32(0);
+    put64(ops_hash());
+    put64(at_pc);
+    put64(p);
+    put64(program_input.offset());
+    put64(program_output.offset());
+    put64(size);
+
+    // skip the blocks that hold only zeros
+    const size_t block_cells = checkpoint_block / sizeof(Cell);
+    for (size_t first = 0; first < size; first += block_cells) {
+        size_t count = std::min(block_cells, size - first);
+        const Cell* cells = tape.data() + first;
+        if (std::all_of(cells, cells + count, [](Cell c) { return c == 0; })) {
+            continue;
+        }
+        put64(first / block_cells);
+        put(cells, count * sizeof(Cell));
+    }
+    put64(checkpoint_end);
+
+    out.close();
+    if (!out || std::rename(temp_file.c_str(), checkpoint_file.c_str()) != 0) {
+        error("Cannot write checkpoint: " + checkpoint_file);
+    }
+}
+
+// continue from a checkpoint instead of the start of the program: the
+// input up to the checkpoint is skipped, and output continues after it
+template<typename Cell>
+void BFVM<Cell>::resume(const std::string& filename) {
+    if (tier0) {
+        optimize_program();     // checkpoints refer to the optimized program
+    }
+    std::ifstream in(filename, std::ios::binary);
+    if (!in) {
+        error("Cannot open checkpoint: " + filename);
+    }
+    auto get = [&](void* data, size_t size) {
+        if (!in.read(static_cast<char*>(data), size)) {
+            error("Invalid checkpoint: " + filename);
+        }
+    };
+    auto get32 = [&]() {
+        uint32_t value = 0;
+        get(&value, sizeof(value));
+        return value;
+    };
+    auto get64 = [&]() {
+        uint64_t value = 0;
+        get(&value, sizeof(value));
+        return value;
+    };
+
+    char magic[sizeof(checkpoint_magic)];
+    get(magic, sizeof(magic));
+    if (std::memcmp(magic, checkpoint_magic, sizeof(magic)) != 0 ||
+            get32() != checkpoint_version) {
+        error("Invalid checkpoint: " + filename);
+    }
+    uint32_t width = get32();
+    get32();
+    if (width != 8 * sizeof(Cell) || get64() != ops_hash()) {
+        error("Checkpoint does not match the program: " + filename);
+    }
+
+    uint64_t at_pc = get64();
+    uint64_t at_ptr = get64();
+    uint64_t input_offset = get64();
+    uint64_t output_offset = get64();
+    uint64_t size = get64();
+    if (at_pc > ops.size() || at_ptr >= size || size > (static_cast<uint64_t>(1) << 40)) {
+        error("Invalid checkpoint: " + filename);
+    }
+
+    std::vector<Cell> cells(static_cast<size_t>(size), 0);
+    const size_t block_cells = checkpoint_block / sizeof(Cell);
+    for (uint64_t index = get64(); index != checkpoint_end; index = get64()) {
+        if (index >= (size + block_cells - 1) / block_cells) {
+            error("Invalid checkpoint: " + filename);
+        }
+        size_t first = static_cast<size_t>(index) * block_cells;
+        get(cells.data() + first, std::min(block_cells, cells.size() - first) * sizeof(Cell));
+    }
+
+    start_tape = std::move(cells);
+    start_ptr = static_cast<int>(at_ptr);
+    start_pc = static_cast<int>(at_pc);
+    start_output.clear();
+    tape_extent = 0;    // a state read from a file is not covered by the analysis
+
+    program_input.skip(input_offset);
+    program_output.resume_at(output_offset);
+}
+
+// The run loops count down the loop iterations, taken EndLoop jumps, and
+// call poll() every poll_interval of them, and at the last one of the
+// budget. The run stops at that EndLoop, before its jump.
+static const int64_t poll_interval = 1 << 16;
+
+template<typename Cell>
+void BFVM<Cell>::start_polls() {
+    status = RunStatus::Finished;
+    steps_run = 0;
+    checkpoints_started = false;
+    poll_period = poll_interval;
+    if (step_budget != 0) {
+        poll_period = static_cast<int64_t>(std::min<uint64_t>(poll_interval, step_budget));
+    }
+    if (time_budget > 0) {
+        deadline = std::chrono::steady_clock::now() +
+                   std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                       std::chrono::duration<double>(time_budget));
+    }
+}
+
+// called by the run loops at the EndLoop at_pc, with the pointer at p, when
+// a poll period ends; returns the length of the next period, or 0 to stop
+// the run before that op
+template<typename Cell>
+int64_t BFVM<Cell>::poll(int p, int at_pc) {
+    steps_run += poll_period;
+    if (checkpoint_due()) {
+        write_checkpoint(p, at_pc);
+    }
+    if (step_budget != 0 && steps_run >= step_budget) {
+        status = RunStatus::StepLimit;
+    }
+    else if (time_budget > 0 && std::chrono::steady_clock::now() >= deadline) {
+        status = RunStatus::TimeLimit;
+    }
+    if (status != RunStatus::Finished) {
+        ptr = p;
+        pc = at_pc;
+        return 0;
+    }
+
+    poll_period = poll_interval;
+    if (step_budget != 0) {
+        poll_period = static_cast<int64_t>(std::min<uint64_t>(poll_interval, step_budget - steps_run));
+    }
+    return poll_period;
+}
+
+template<typename Cell>
+void BFVM<Cell>::write_text(const std::string& text) {
+    program_output.put(reinterpret_cast<const uint8_t*>(text.data()), text.size());
+}
+
+template<typename Cell>
+RunStatus BFVM<Cell>::run() {
+    // only the tiered engine runs the tier 0 ops, and not with tracing,
+    // profiling or checkpoints, which report on the optimized program
+    if (tier0 && (engine != Engine::Tiered || trace || profile || !checkpoint_file.empty())) {
+        optimize_program();
+    }
+    pc = start_pc;
+    ptr = start_ptr;
+
+    // with a static extent no access can leave the tape; a guarded tape
+    // catches out of bounds accesses in hardware, as long as no op reaches
+    // past the guard pages
+    bool checked = true;
+    GuardHandler guard_handler;
+    CheckpointHandler checkpoint_handler;
+    if (tape_extent > 0) {
+        tape.reset();
+        tape.resize(tape_extent);
+        checked = false;
+    }
+    else if (guard_tape && !tier0 && guard_handler.install()) {
+        int below = 0, above = 0;
+        reach_of_ops(below, above);
+        checked = !tape.reset_guarded(below, above);
+    }
+    if (checked) {
+        tape.reset();   // initialize tape with one cell
+    }
+
+    // resume from the state computed at compile time
+    if (!start_tape.empty()) {
+        if (start_tape.size() > tape.size()) {
+            tape.resize(start_tape.size());
+        }
+        std::memcpy(tape.data(), start_tape.data(), start_tape.size() * sizeof(Cell));
+    }
+    if (!start_output.empty()) {
+        program_output.put(start_output.data(), start_output.size());
+    }
+    start_polls();
+
+    // tracing and profiling always go through the instrumented loops, so
+    // that the fast loops carry no per-op tests
+    if (trace) {
+        run_traced();
+    }
+    else if (profile) {
+        run_profiled();
+    }
+    else {
+        if (!checkpoint_file.empty()) {
+            checkpoint_handler.install();
+            start_checkpoints();
+        }
+
+        switch (engine) {
+        case Engine::Switch:
+            if (checked) {
+                run_switch<true>();
+            }
+            else {
+                run_escapable([&] { run_switch<false>(); });
+            }
+            break;
+        case Engine::Threaded:
+            if (checked) {
+                run_threaded<true>();
+            }
+            else {
+                run_escapable([&] { run_threaded<false>(); });
+            }
+            break;
+        case Engine::Jit:
+            run_jit(checked);
+            break;
+        case Engine::Tiered: {
+            bool hot = false;
+            if (!tier0) {
+                hot = true;
+            }
+            else if (checked) {
+                hot = run_counted<true>();
+            }
+            else {
+                run_escapable([&] { hot = run_counted<false>(); });
+            }
+            bool tiered_up = false;
+            if (hot && tier0) {
+                // continue at the same EndLoop of the optimized program
+                int source = ops[pc].source;
+                optimize_hot_program();
+                tiered_up = true;
+                pc = static_cast<int>(std::find_if(ops.begin(), ops.end(), [&](const Op& op) {
+                    return op.type == OpType::EndLoop && op.source == source;
+                }) - ops.begin());
+                if (pc == static_cast<int>(ops.size())) {
+                    error("Hot loop not found in the optimized program");
+                }
+                checked = (tape_extent == 0);
+                if (!checked && tape.size() < tape_extent) {
+                    tape.resize(tape_extent);
+                }
+            }
+            if (hot) {
+                run_jit(checked);
+            }
+            if (tiered_up) {
+                encode_start();
+            }
+            break;
+        }
+        default:
+            error("Invalid engine");
+        }
+
+        // the last move is not followed by an access that would fault
+        if (!checked && status == RunStatus::Finished) {
+            check_ptr(ptr);
+        }
+    }
+
+    program_output.flush();
+    return status;
+}
+
+// the trace goes to the program output, in order with the program I/O
+template<typename Cell>
+void BFVM<Cell>::run_traced() {
+    int64_t countdown = poll_period;
+    while (pc < static_cast<int>(ops.size())) {
+        const Op& op = ops[pc];
+        write_text("PC=" + std::to_string(pc) + " instr=" + op.to_string() + "\n");
+
+        switch (op.type) {
+        case OpType::Move:
+            ptr += op.value;
+            check_ptr(ptr);
+            break;
+
+        case OpType::Clear:
+            cell<true>(ptr + op.offset) = 0;
+            break;
+
+        case OpType::Set:
+            cell<true>(ptr + op.offset) = static_cast<Cell>(op.value);
+            break;
+
+        case OpType::Increment:
+            cell<true>(ptr + op.offset) += static_cast<Cell>(op.value);
+            break;
+
+        case OpType::Multiply:
+            multiply<true>(op, ptr);
+            break;
+
+        case OpType::Scan:
+            ptr = scan(op.value, ptr);
+            break;
+
+        case OpType::StartLoop:
+            if (tape[ptr] == 0) {
+                pc = jumps[pc];
+                if (pc < 0) {
+                    error("Invalid jump");
+                }
+                continue;      // do not pc++ below
+            }
+            break;
+
+        case OpType::EndLoop:
+            if (tape[ptr] != 0) {
+                if (--countdown == 0 && (countdown = poll(ptr, pc)) == 0) {
+                    return;
+                }
+                pc = jumps[pc];
+                if (pc < 0) {
+                    error("Invalid jump");
+                }
+                continue;      // do not pc++ below
+            }
+            break;
+
+        case OpType::Input:
+            cell<true>(ptr + op.offset) = static_cast<Cell>(program_input.get());
+            break;
+
+        case OpType::Output:
+            program_output.put(static_cast<uint8_t>(cell<true>(ptr + op.offset)));
+            break;
+
+        case OpType::If:
+            if (cell<true>(ptr + op.offset) == 0) {
+                pc = jumps[pc];
+            }
+            break;
+
+        default:
+            error("Invalid op");
+        }
+
+        std::ostringstream state;
+        dump_state(state);
+        write_text(state.str());
+        pc++;
+    }
+}
+
+static int iteration_bucket(uint64_t iterations) {
+    int bucket = 0;
+    while (iterations != 0) {
+        bucket++;
+        iterations >>= 1;
+    }
+    return bucket;
+}
+
+template<typename Cell>
+void BFVM<Cell>::run_profiled() {
+    int n = static_cast<int>(ops.size());
+    op_counts.assign(n, 0);
+
+    // profile of each loop, addressed by both its StartLoop and EndLoop ops
+    loop_profiles.clear();
+    std::vector<int> loop_of(n, -1);
+    for (int k = 0; k < n; k++) {
+        if (ops[k].type == OpType::StartLoop) {
+            loop_of[k] = loop_of[jumps[k]] = static_cast<int>(loop_profiles.size());
+            loop_profiles.push_back(LoopProfile());
+            loop_profiles.back().start = k;
+        }
+    }
+
+    // innermost loop of each op in tape_loops, a loop's own StartLoop and
+    // EndLoop included
+    std::vector<int> tape_loop_of;
+    if (tape_profile) {
+        tape_loops.assign(loop_profiles.size() + 1, TapeLoop());
+        tape_loop_of.assign(n, 0);
+        std::vector<int> open;
+        for (int k = 0; k < n; k++) {
+            if (ops[k].type == OpType::StartLoop) {
+                open.push_back(loop_of[k] + 1);
+            }
+            tape_loop_of[k] = open.empty() ? 0 : open.back();
+            if (ops[k].type == OpType::EndLoop) {
+                open.pop_back();
+            }
+        }
+    }
+
+    const Op* code_ops = ops.data();
+    const int* code_jumps = jumps.data();
+    uint64_t* counts = op_counts.data();
+    int p = ptr;
+    int i = pc;
+    int64_t countdown = poll_period;
+
+    // tape profile of op i, which has run
+    auto access = [&](int c, int reads, int writes) {
+        if (tape_profile) {
+            count_access(tape_loops[tape_loop_of[i]], c, reads, writes);
+        }
+    };
+
+    while (i < n) {
+        const Op& op = code_ops[i];
+        counts[i]++;
+        switch (op.type) {
+        case OpType::Move:
+            p += op.value;
+            check_ptr(p);
+            if (tape_profile) {
+                tape_loops[tape_loop_of[i]].travel += std::abs(op.value);
+            }
+            break;
+
+        case OpType::Clear:
+            cell<true>(p + op.offset) = 0;
+            access(p + op.offset, 0, 1);
+            break;
+
+        case OpType::Set:
+            cell<true>(p + op.offset) = static_cast<Cell>(op.value);
+            access(p + op.offset, 0, 1);
+            break;
+
+        case OpType::Increment:
+            cell<true>(p + op.offset) += static_cast<Cell>(op.value);
+            access(p + op.offset, 1, 1);
+            break;
+
+        case OpType::Multiply:
+            if (tape_profile) {
+                // the targets are only read and written if the cell is not 0
+                bool zero = (cell<true>(p + op.offset) == 0);
+                multiply<true>(op, p);
+                access(p + op.offset, 1, zero ? 0 : 1);
+                for (const auto& target : op.targets) {
+                    if (!zero) {
+                        access(p + op.offset + target.offset, 1, 1);
+                    }
+                }
+            }
+            else {
+                multiply<true>(op, p);
+            }
+            break;
+
+        case OpType::Scan:
+            if (tape_profile) {
+                int from = p;
+                p = scan(op.value, p);
+                for (int c = from; c != p; c += op.value) {
+                    access(c, 1, 0);
+                }
+                access(p, 1, 0);
+                tape_loops[tape_loop_of[i]].travel += std::abs(p - from);
+            }
+            else {
+                p = scan(op.value, p);
+            }
+            break;
+
+        case OpType::StartLoop: {
+            LoopProfile& loop = loop_profiles[loop_of[i]];
+            access(p, 1, 0);
+            if (tape[p] == 0) {
+                loop.histogram[0]++;
+                i = code_jumps[i];
+            }
+            else {
+                loop.iterations = 1;
+            }
+            break;
+        }
+        case OpType::EndLoop: {
+            LoopProfile& loop = loop_profiles[loop_of[i]];
+            access(p, 1, 0);
+            if (tape[p] != 0) {
+                if (--countdown == 0 && (countdown = poll(p, i)) == 0) {
+                    return;
+                }
+                loop.iterations++;
+                i = code_jumps[i];
+            }
+            else {
+                int bucket = std::min(iteration_bucket(loop.iterations), profile_buckets - 1);
+                loop.histogram[bucket]++;
+            }
+            break;
+        }
+        case OpType::Input:
+            cell<true>(p + op.offset) = static_cast<Cell>(program_input.get());
+            access(p + op.offset, 0, 1);
+            break;
+
+        case OpType::Output:
+            program_output.put(static_cast<uint8_t>(cell<true>(p + op.offset)));
+            access(p + op.offset, 1, 0);
+            break;
+
+        case OpType::If:
+            access(p + op.offset, 1, 0);
+            if (cell<true>(p + op.offset) == 0) {
+                i = code_jumps[i];
+            }
+            break;
+
+        default:
+            error("Invalid op");
+        }
+        i++;
+    }
+
+    ptr = p;
+    pc = i;
+}
+
+// line:column (offset N) of a command in the source
+template<typename Cell>
+std::string BFVM<Cell>::source_position(int source) const {
+    if (code_offsets.empty()) {
+        return "-";
+    }
+    size_t offset = code_offsets[std::min(static_cast<size_t>(source), code_offsets.size() - 1)];
+    std::pair<size_t, size_t> line_column = source_line_column(offset);
+
+    std::ostringstream oss;
+    oss << line_column.first << ":" << line_column.second << " (offset " << offset << ")";
+    return oss.str();
+}
+
+// line and column of an offset in the source
+template<typename Cell>
+std::pair<size_t, size_t> BFVM<Cell>::source_line_column(size_t offset) const {
+    size_t line = std::upper_bound(line_starts.begin(), line_starts.end(), offset) - line_starts.begin();
+    return { line, offset - line_starts[line - 1] + 1 };
+}
+
+template<typename Cell>
+uint64_t BFVM<Cell>::ops_executed() const {
+    uint64_t total = 0;
+    for (uint64_t count : op_counts) {
+        total += count;
+    }
+    return total;
+}
+
+// hottest loops by ops executed inside them, and hottest ops
+template<typename Cell>
+void BFVM<Cell>::write_profile(std::ostream& out) const {
+    static const size_t max_lines = 10;
+
+    int n = static_cast<int>(ops.size());
+    std::vector<uint64_t> sums(n + 1, 0);
+    for (int k = 0; k < n; k++) {
+        sums[k + 1] = sums[k] + op_counts[k];
+    }
+    uint64_t total = sums[n];
+
+    auto percent = [&](uint64_t count) {
+        std::ostringstream oss;
+        oss << std::fixed << std::setprecision(1)
+            << (total == 0 ? 0.0 : 100.0 * static_cast<double>(count) / static_cast<double>(total)) << "%";
+        return oss.str();
+    };
+
+    out << "Profile: " << total << " ops executed, " << n << " ops, "
+        << loop_profiles.size() << " loops\n";
+
+    // loops, by ops executed from StartLoop to EndLoop inclusive
+    std::vector<std::pair<uint64_t, int>> loops;
+    for (int k = 0; k < static_cast<int>(loop_profiles.size()); k++) {
+        int start = loop_profiles[k].start;
+        loops.push_back({ sums[jumps[start] + 1] - sums[start], k });
+    }
+    std::stable_sort(loops.begin(), loops.end(), [](const std::pair<uint64_t, int>& a,
+    const std::pair<uint64_t, int>& b) {
+        return a.first > b.first;
+    });
+
+    out << "\nHottest loops:\n";
+    out << std::setw(14) << "ops" << std::setw(8) << "%" << std::setw(12) << "entries"
+        << std::setw(14) << "iterations" << "  ops      source\n";
+    for (size_t k = 0; k < loops.size() && k < max_lines && loops[k].first > 0; k++) {
+        const LoopProfile& loop = loop_profiles[loops[k].second];
+        int start = loop.start;
+        int end = jumps[start];
+        out << std::setw(14) << loops[k].first << std::setw(8) << percent(loops[k].first)
+            << std::setw(12) << op_counts[start] << std::setw(14) << op_counts[end] << "  "
+            << std::left << std::setw(9) << (std::to_string(start) + "-" + std::to_string(end))
+            << std::right << source_position(ops[start].source) << "\n";
+
+        out << std::setw(14) << "" << "  iterations per entry:";
+        for (int bucket = 0; bucket < profile_buckets; bucket++) {
+            if (loop.histogram[bucket] == 0) {
+                continue;
+            }
+            uint64_t low = bucket == 0 ? 0 : static_cast<uint64_t>(1) << (bucket - 1);
+            uint64_t high = bucket == 0 ? 0 : (low << 1) - 1;
+            out << " " << low;
+            if (high > low) {
+                out << "-" << high;
+            }
+            out << ":" << loop.histogram[bucket];
+        }
+        out << "\n";
+    }
+
+    // single ops
+    std::vector<std::pair<uint64_t, int>> hot_ops;
+    for (int k = 0; k < n; k++) {
+        hot_ops.push_back({ op_counts[k], k });
+    }
+    std::stable_sort(hot_ops.begin(), hot_ops.end(), [](const std::pair<uint64_t, int>& a,
+    const std::pair<uint64_t, int>& b) {
+        return a.first > b.first;
+    });
+
+    out << "\nHottest ops:\n";
+    out << std::setw(14) << "count" << std::setw(8) << "%" << "  " << std::left << std::setw(7) << "op"
+        << std::setw(24) << "instr" << std::right << "source\n";
+    for (size_t k = 0; k < hot_ops.size() && k < max_lines && hot_ops[k].first > 0; k++) {
+        int op = hot_ops[k].second;
+        out << std::setw(14) << hot_ops[k].first << std::setw(8) << percent(hot_ops[k].first) << "  "
+            << std::left << std::setw(7) << op << std::setw(24) << ops[op].to_string()
+            << std::right << source_position(ops[op].source) << "\n";
+    }
+}
+
+// accesses, cells touched and pointer travel, then the loops that move the
+// pointer most and the most accessed cells
+template<typename Cell>
+void BFVM<Cell>::write_tape_profile(std::ostream& out) const {
+    static const size_t max_lines = 10;
+
+    uint64_t reads = 0, writes = 0, travel = 0;
+    std::vector<TapeCell> cells;
+    for (const TapeLoop& loop : tape_loops) {
+        travel += loop.travel;
+        for (size_t k = 0; k < loop.cells.size(); k++) {
+            size_t c = loop.base + k;
+            if (c >= cells.size()) {
+                cells.resize(c + 1);
+            }
+            cells[c].reads += loop.cells[k].reads;
+            cells[c].writes += loop.cells[k].writes;
+            reads += loop.cells[k].reads;
+            writes += loop.cells[k].writes;
+        }
+    }
+
+    int touched = 0;
+    for (const TapeCell& c : cells) {
+        if (c.reads + c.writes != 0) {
+            touched++;
+        }
+    }
+
+    // Move and Scan ops, which only move the pointer
+    uint64_t total = ops_executed(), moves = 0;
+    for (size_t k = 0; k < ops.size() && k < op_counts.size(); k++) {
+        if (ops[k].type == OpType::Move || ops[k].type == OpType::Scan) {
+            moves += op_counts[k];
+        }
+    }
+
+    std::ostringstream percent;
+    percent << std::fixed << std::setprecision(1)
+            << (total == 0 ? 0.0 : 100.0 * static_cast<double>(moves) / static_cast<double>(total)) << "%";
+
+    out << "Tape profile: " << touched << " cells, " << reads << " reads, "
+        << writes << " writes, pointer travel " << travel << "\n";
+    out << "Pointer moves: " << moves << " of " << total << " ops executed ("
+        << percent.str() << ")\n";
+
+    std::vector<std::pair<uint64_t, int>> loops;
+    for (int k = 1; k < static_cast<int>(tape_loops.size()); k++) {
+        loops.push_back({ tape_loops[k].travel, k });
+    }
+    std::stable_sort(loops.begin(), loops.end(), [](const std::pair<uint64_t, int>& a,
+    const std::pair<uint64_t, int>& b) {
+        return a.first > b.first;
+    });
+
+    out << "\nMost pointer travel:\n";
+    out << std::setw(14) << "travel" << "  " << std::left << std::setw(14) << "ops"
+        << std::right << "source\n";
+    if (!tape_loops.empty() && tape_loops[0].travel > 0) {
+        out << std::setw(14) << tape_loops[0].travel << "  " << std::left << std::setw(14) << "top"
+            << std::right << "-\n";
+    }
+    for (size_t k = 0; k < loops.size() && k < max_lines && loops[k].first > 0; k++) {
+        int start = loop_profiles[loops[k].second - 1].start;
+        out << std::setw(14) << loops[k].first << "  " << std::left << std::setw(14)
+            << (std::to_string(start) + "-" + std::to_string(jumps[start]) + " ")
+            << std::right << source_position(ops[start].source) << "\n";
+    }
+
+    std::vector<std::pair<uint64_t, int>> hot_cells;
+    for (int c = 0; c < static_cast<int>(cells.size()); c++) {
+        hot_cells.push_back({ cells[c].reads + cells[c].writes, c });
+    }
+    std::stable_sort(hot_cells.begin(), hot_cells.end(), [](const std::pair<uint64_t, int>& a,
+    const std::pair<uint64_t, int>& b) {
+        return a.first > b.first;
+    });
+
+    out << "\nMost accessed cells:\n";
+    out << std::setw(8) << "cell" << std::setw(14) << "reads" << std::setw(14) << "writes" << "\n";
+    for (size_t k = 0; k < hot_cells.size() && k < max_lines && hot_cells[k].first > 0; k++) {
+        const TapeCell& c = cells[hot_cells[k].second];
+        out << std::setw(8) << hot_cells[k].second << std::setw(14) << c.reads
+            << std::setw(14) << c.writes << "\n";
+    }
+}
+
+// CSV of the loops entered, the top level first: a row with cell * of the
+// loop totals, then a row per cell it touched
+template<typename Cell>
+void BFVM<Cell>::write_tape_heatmap(std::ostream& out) const {
+    out << "loop,line,column,cell,reads,writes,travel\n";
+    for (size_t k = 0; k < tape_loops.size(); k++) {
+        const TapeLoop& loop = tape_loops[k];
+        if (loop.cells.empty() && loop.travel == 0) {
+            continue;
+        }
+
+        std::string prefix = "top,,,";
+        if (k > 0) {
+            int start = loop_profiles[k - 1].start;
+            prefix = std::to_string(start) + ",";
+            if (code_offsets.empty()) {
+                prefix += ",,";
+            }
+            else {
+                size_t offset = code_offsets[std::min(static_cast<size_t>(ops[start].source), code_offsets.size() - 1)];
+                std::pair<size_t, size_t> line_column = source_line_column(offset);
+                prefix += std::to_string(line_column.first) + "," + std::to_string(line_column.second) + ",";
+            }
+        }
+
+        uint64_t reads = 0, writes = 0;
+        for (const TapeCell& c : loop.cells) {
+            reads += c.reads;
+            writes += c.writes;
+        }
+        out << prefix << "*," << reads << "," << writes << "," << loop.travel << "\n";
+        for (size_t c = 0; c < loop.cells.size(); c++) {
+            if (loop.cells[c].reads + loop.cells[c].writes != 0) {
+                out << prefix << loop.base + c << "," << loop.cells[c].reads << ","
+                    << loop.cells[c].writes << ",\n";
+            }
+        }
+    }
+}
+
+template<typename Cell>
+template<bool Checked>
+void BFVM<Cell>::run_switch() {
+    // keep pc and ptr in locals: stores to the tape may alias the members
+    const Instr<Cell>* code = instrs.data();
+    const MultiplyTarget* table = multiply_table.data();
+    int n = static_cast<int>(instrs.size());
+    int p = ptr;
+    int i = pc;
+    int64_t countdown = poll_period;
+
+    while (i < n) {
+        const Instr<Cell>& op = code[i];
+        switch (op.type) {
+        case OpType::Move:
+            p += op.arg;
+            if (p < 0 || (Checked && p >= static_cast<int>(tape.size()))) {
+                check_ptr(p);
+            }
+            break;
+
+        case OpType::Clear:
+            cell<Checked>(p + op.arg) = 0;
+            break;
+
+        case OpType::Set:
+            cell<Checked>(p + op.arg) = op.value;
+            break;
+
+        case OpType::Increment:
+            cell<Checked>(p + op.arg) += op.value;
+            break;
+
+        case OpType::Multiply:
+            multiply<Checked>(table + op.arg, p);
+            break;
+
+        case OpType::Scan:
+            p = scan(op.arg, p);
+            break;
+
+        case OpType::StartLoop:
+            if (tape[p] == 0) {
+                i = op.arg;
+            }
+            break;
+
+        case OpType::EndLoop:
+            if (tape[p] != 0) {
+                if (--countdown == 0 && (countdown = poll(p, i)) == 0) {
+                    return;
+                }
+                i = op.arg;
+            }
+            break;
+
+        case OpType::Input:
+            cell<Checked>(p + op.arg) = static_cast<Cell>(program_input.get());
+            break;
+
+        case OpType::Output:
+            program_output.put(static_cast<uint8_t>(cell<Checked>(p + op.arg)));
+            break;
+
+        case OpType::If:
+            if (cell<Checked>(p + if_offset(op)) == 0) {
+                i = op.arg;
+            }
+            break;
+
+        default:
+            error("Invalid op");
+        }
+        i++;
+    }
+
+    ptr = p;
+    pc = i;
+}
+
+// run_switch() on the tier 0 ops of tiered execution, counting the back
+// edges of each loop; stops at the EndLoop of the first loop to reach
+// hot_loop_threshold of them, before its jump, and returns true
+static const uint32_t hot_loop_threshold = 10000;
+
+template<typename Cell>
+template<bool Checked>
+bool BFVM<Cell>::run_counted() {
+    const Instr<Cell>* code = instrs.data();
+    const MultiplyTarget* table = multiply_table.data();
+    int n = static_cast<int>(instrs.size());
+    int p = ptr;
+    int i = pc;
+    int64_t countdown = poll_period;
+    if (back_edges.size() != instrs.size()) {
+        back_edges.assign(instrs.size(), 0);    // kept over runs
+    }
+    uint32_t* counts = back_edges.data();
+
+    while (i < n) {
+        const Instr<Cell>& op = code[i];
+        switch (op.type) {
+        case OpType::Move:
+            p += op.arg;
+            if (p < 0 || (Checked && p >= static_cast<int>(tape.size()))) {
+                check_ptr(p);
+            }
+            break;
+
+        case OpType::Clear:
+            cell<Checked>(p + op.arg) = 0;
+            break;
+
+        case OpType::Set:
+            cell<Checked>(p + op.arg) = op.value;
+            break;
+
+        case OpType::Increment:
+            cell<Checked>(p + op.arg) += op.value;
+            break;
+
+        case OpType::Multiply:
+            multiply<Checked>(table + op.arg, p);
+            break;
+
+        case OpType::Scan:
+            p = scan(op.arg, p);
+            break;
+
+        case OpType::StartLoop:
+            if (tape[p] == 0) {
+                i = op.arg;
+            }
+            break;
+
+        case OpType::EndLoop:
+            if (tape[p] != 0) {
+                if (++counts[i] == hot_loop_threshold) {
+                    // the iterations of this poll period so far are charged
+                    // now, the rest by the next run loop
+                    steps_run += poll_period - countdown;
+                    poll_period = countdown;
+                    ptr = p;
+                    pc = i;
+                    return true;
+                }
+                if (--countdown == 0 && (countdown = poll(p, i)) == 0) {
+                    return false;
+                }
+                i = op.arg;
+            }
+            break;
+
+        case OpType::Input:
+            cell<Checked>(p + op.arg) = static_cast<Cell>(program_input.get());
+            break;
+
+        case OpType::Output:
+            program_output.put(static_cast<uint8_t>(cell<Checked>(p + op.arg)));
+            break;
+
+        default:
+            error("Invalid op");
+        }
+        i++;
+    }
+
+    ptr = p;
+    pc = i;
+    return false;
+}
+
+#ifdef BF_HAVE_THREADED
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+
+template<typename Cell>
+template<bool Checked>
+void BFVM<Cell>::run_threaded() {
+    // handler addresses, in OpType order
+    static const void* const labels[] = {
+        &&do_move,
+        &&do_clear,
+        &&do_set,
+        &&do_increment,
+        &&do_multiply,
+        &&do_scan,
+        &&do_start_loop,
+        &&do_end_loop,
+        &&do_input,
+        &&do_output,
+        &&do_if,
+    };
+
+    // pre-resolve the handler of each op; the extra entry stops the machine
+    int n = static_cast<int>(instrs.size());
+    threaded_handlers.resize(n + 1);
+    for (int k = 0; k < n; k++) {
+        threaded_handlers[k] = labels[static_cast<int>(instrs[k].type)];
+    }
+    threaded_handlers[n] = &&do_halt;
+
+    const void* const* code_handlers = threaded_handlers.data();
+    const Instr<Cell>* code = instrs.data();
+    const MultiplyTarget* table = multiply_table.data();
+    int p = ptr;
+    int i = pc;
+    int64_t countdown = poll_period;
+
+#define DISPATCH()  goto *code_handlers[i]
+#define NEXT()      do { i++; DISPATCH(); } while (0)
+
+    DISPATCH();
+
+do_move:
+    p += code[i].arg;
+    if (p < 0 || (Checked && p >= static_cast<int>(tape.size()))) {
+        check_ptr(p);
+    }
+    NEXT();
+
+do_clear:
+    cell<Checked>(p + code[i].arg) = 0;
+    NEXT();
+
+do_set:
+    cell<Checked>(p + code[i].arg) = code[i].value;
+    NEXT();
+
+do_increment:
+    cell<Checked>(p + code[i].arg) += code[i].value;
+    NEXT();
+
+do_multiply:
+    multiply<Checked>(table + code[i].arg, p);
+    NEXT();
+
+do_scan:
+    p = scan(code[i].arg, p);
+    NEXT();
+
+do_start_loop:
+    if (tape[p] == 0) {
+        i = code[i].arg;
+    }
+    NEXT();
+
+do_end_loop:
+    if (tape[p] != 0) {
+        if (--countdown == 0 && (countdown = poll(p, i)) == 0) {
+            return;
+        }
+        i = code[i].arg;
+    }
+    NEXT();
+
+do_input:
+    cell<Checked>(p + code[i].arg) = static_cast<Cell>(program_input.get());
+    NEXT();
+
+do_output:
+    program_output.put(static_cast<uint8_t>(cell<Checked>(p + code[i].arg)));
+    NEXT();
+
+do_if:
+    if (cell<Checked>(p + if_offset(code[i])) == 0) {
+        i = code[i].arg;
+    }
+    NEXT();
+
+do_halt:
+    ptr = p;
+    pc = i;
+
+#undef DISPATCH
+#undef NEXT
+}
+
+#pragma GCC diagnostic pop
+#else
+template<typename Cell>
+template<bool Checked>
+void BFVM<Cell>::run_threaded() {
+    run_switch<Checked>();  // no labels-as-values: fall back to the switch loop
+}
+#endif
+
+#ifdef BF_HAVE_JIT
+// Emits x86-64 machine code for an op stream. Register usage:
+//   r12 = tape base, r13 = pointer, r14 = tape size, r15 = JitState*
+//   r8..r11, rdx, rbp = cells held in registers
+// r12..r15 are callee-saved, so they survive the calls to the helpers.
+class JitCompiler {
+public:
+    typedef void (*EntryPoint)(JitState* st);
+
+    JitCompiler() = default;
+    JitCompiler(const JitCompiler&) = delete;
+    JitCompiler& operator=(const JitCompiler&) = delete;
+    ~JitCompiler();
+
+    EntryPoint compile(const std::vector<Op>& ops, bool checked, bool bounded, int entry, bool polls);
+
+private:
+    std::vector<uint8_t> code;
+    void* mem = nullptr;
+    size_t mem_size = 0;
+    bool checked = true;    // false: the tape has guard pages or a static extent
+    bool bounded = false;   // every access of the ops is inside the tape
+    int reach_lo = 0;       // cells [ptr+reach_lo, ptr+reach_hi] known to exist
+    int reach_hi = 0;
+
+    // Cells held in registers within straight-line code: loaded on first
+    // use, and written back before branches, labels and calls, after which
+    // the registers hold nothing
+    struct CachedCell {
+        bool valid = false;
+        bool dirty = false;     // to write back
+        int offset = 0;         // from the pointer
+        unsigned last_use = 0;
+    };
+    static const int cell_regs = 6;
+    CachedCell cells[cell_regs];
+    unsigned use_count = 0;
+
+    int find_cell(int offset) const;
+    int cache_cell(int offset, bool load);
+    void write_back(int slot);
+    void flush_cells();
+    void forget_cells();
+    void store_dirty_cells();
+    void reload_cells();
+    void emit_test_cell(int offset);
+    bool loop_in_registers(const std::vector<Op>& ops, int start, int entry,
+                           std::vector<int>& offsets) const;
+
+    void emit(std::initializer_list<uint8_t> bytes);
+    void emit32(int32_t value);
+    void emit64(uint64_t value);
+    size_t emit_jcc(uint8_t cc);     // forward jump, returns patch position
+    void emit_jcc_to(uint8_t cc, size_t target);
+    void patch(size_t pos);
+
+    void emit_cell(uint8_t opcode, uint8_t reg, int32_t offset);
+    void emit_call(void* func);
+    void emit_reload();
+    void emit_grow_rsi();
+    void emit_underflow();
+    void emit_reach(int offset);
+    void emit_cell_address(int offset);
+
+    void emit_prologue();
+    void emit_epilogue();
+    void emit_move(int value);
+    void emit_multiply(const Op& op);
+    void emit_multiply_in_memory(const Op& op, int min_offset, int max_offset);
+    void emit_scan(int stride);
+    void emit_end_loop(int at_pc, size_t body, bool poll);
+
+    EntryPoint finish();
+};
+
+// condition codes for Jcc rel32 (0F 8x)
+static const uint8_t CC_E = 0x84;
+static const uint8_t CC_NE = 0x85;
+static const uint8_t CC_S = 0x88;
+static const uint8_t CC_NS = 0x89;
+static const uint8_t CC_L = 0x8C;
+
+JitCompiler::~JitCompiler() {
+    if (mem != nullptr) {
+        munmap(mem, mem_size);
+    }
+}
+
+// register of each cell slot
+static const uint8_t cell_reg[] = { 8, 9, 10, 11, 2, 5 };
+
+// REX prefix of an instruction with register operand reg and register or
+// base operand rm; always emitted, so that bpl is addressable
+static uint8_t rex(int reg, int rm) {
+    return static_cast<uint8_t>(0x40 | ((reg & 8) >> 1) | ((rm & 8) >> 3));
+}
+
+// ModRM byte of a register to register instruction
+static uint8_t modrm(int reg, int rm) {
+    return static_cast<uint8_t>(0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+void JitCompiler::emit(std::initializer_list<uint8_t> bytes) {
+    code.insert(code.end(), bytes);
+}
+
+void JitCompiler::emit32(int32_t value) {
+    uint32_t v = static_cast<uint32_t>(value);
+    for (int i = 0; i < 4; i++) {
+        code.push_back(static_cast<uint8_t>(v >> (8 * i)));
+    }
+}
+
+void JitCompiler::emit64(uint64_t value) {
+    for (int i = 0; i < 8; i++) {
+        code.push_back(static_cast<uint8_t>(value >> (8 * i)));
+    }
+}
+
+size_t JitCompiler::emit_jcc(uint8_t cc) {
+    emit({ 0x0F, cc });
+    size_t pos = code.size();
+    emit32(0);
+    return pos;
+}
+
+void JitCompiler::emit_jcc_to(uint8_t cc, size_t target) {
+    emit({ 0x0F, cc });
+    emit32(static_cast<int32_t>(target - (code.size() + 4)));
+}
+
+void JitCompiler::patch(size_t pos) {
+    int32_t rel = static_cast<int32_t>(code.size() - (pos + 4));
+    std::memcpy(&code[pos], &rel, sizeof(rel));
+}
+
+// <opcode> with memory operand byte [r12 + r13 + offset]
+void JitCompiler::emit_cell(uint8_t opcode, uint8_t reg, int32_t offset) {
+    emit({ static_cast<uint8_t>(0x43 | ((reg & 8) >> 1)), opcode,
+           static_cast<uint8_t>(0x84 | ((reg & 7) << 3)), 0x2C });
+    emit32(offset);
+}
+
+int JitCompiler::find_cell(int offset) const {
+    for (int slot = 0; slot < cell_regs; slot++) {
+        if (cells[slot].valid && cells[slot].offset == offset) {
+            return slot;
+        }
+    }
+    return -1;
+}
+
+// the slot of cell [ptr+offset], in a free register or in the least
+// recently used one; load: with the value of the cell
+int JitCompiler::cache_cell(int offset, bool load) {
+    int slot = find_cell(offset);
+    if (slot < 0) {
+        slot = 0;
+        for (int i = 0; i < cell_regs && cells[slot].valid; i++) {
+            if (!cells[i].valid || cells[i].last_use < cells[slot].last_use) {
+                slot = i;
+            }
+        }
+        write_back(slot);
+        cells[slot].valid = true;
+        cells[slot].dirty = false;
+        cells[slot].offset = offset;
+        if (load) {
+            uint8_t reg = cell_reg[slot];
+            emit({ static_cast<uint8_t>(0x43 | ((reg & 8) >> 1)), 0x0F, 0xB6,
+                   static_cast<uint8_t>(0x84 | ((reg & 7) << 3)), 0x2C });
+            emit32(offset);                             // movzx reg, byte [cell]
+        }
+    }
+    cells[slot].last_use = ++use_count;
+    return slot;
+}
+
+void JitCompiler::write_back(int slot) {
+    if (cells[slot].valid && cells[slot].dirty) {
+        emit_cell(0x88, cell_reg[slot], cells[slot].offset);   // mov byte [cell], reg
+        cells[slot].dirty = false;
+    }
+}
+
+void JitCompiler::flush_cells() {
+    for (int slot = 0; slot < cell_regs; slot++) {
+        write_back(slot);
+    }
+}
+
+void JitCompiler::forget_cells() {
+    for (auto& cell : cells) {
+        cell.valid = false;
+        cell.dirty = false;
+    }
+}
+
+// around a call on a path that continues with the cells in registers
+void JitCompiler::store_dirty_cells() {
+    for (int slot = 0; slot < cell_regs; slot++) {
+        if (cells[slot].valid && cells[slot].dirty) {
+            emit_cell(0x88, cell_reg[slot], cells[slot].offset);   // mov byte [cell], reg
+        }
+    }
+}
+
+void JitCompiler::reload_cells() {
+    for (int slot = 0; slot < cell_regs; slot++) {
+        if (cells[slot].valid) {
+            uint8_t reg = cell_reg[slot];
+            emit({ static_cast<uint8_t>(0x43 | ((reg & 8) >> 1)), 0x0F, 0xB6,
+                   static_cast<uint8_t>(0x84 | ((reg & 7) << 3)), 0x2C });
+            emit32(cells[slot].offset);                 // movzx reg, byte [cell]
+        }
+    }
+}
+
+// flags for a jump on cell [ptr+offset] being zero
+void JitCompiler::emit_test_cell(int offset) {
+    int slot = find_cell(offset);
+    if (slot >= 0) {
+        uint8_t reg = cell_reg[slot];
+        emit({ rex(reg, reg), 0x84, modrm(reg, reg) }); // test reg, reg
+    }
+    else {
+        emit_cell(0x80, 7, offset);                     // cmp byte [cell], 0
+        emit({ 0x00 });
+    }
+}
+
+void JitCompiler::emit_call(void* func) {
+    emit({ 0x48, 0xB8 });                               // mov rax, func
+    emit64(reinterpret_cast<uint64_t>(func));
+    emit({ 0xFF, 0xD0 });                               // call rax
+}
+
+void JitCompiler::emit_reload() {
+    emit({ 0x4D, 0x8B, 0x67, 0x00 });                   // mov r12, [r15+0]
+    emit({ 0x4D, 0x8B, 0x77, 0x08 });                   // mov r14, [r15+8]
+}
+
+// grow the tape to include the cell index in rsi
+void JitCompiler::emit_grow_rsi() {
+    emit({ 0x4C, 0x89, 0xFF });                         // mov rdi, r15
+    emit_call(reinterpret_cast<void*>(&BFVM<uint8_t>::jit_grow));
+    emit_reload();
+}
+
+void JitCompiler::emit_underflow() {
+    emit_call(reinterpret_cast<void*>(&BFVM<uint8_t>::jit_underflow));
+}
+
+// make sure cell [ptr+offset] exists; the checked range is valid until the
+// pointer moves
+void JitCompiler::emit_reach(int offset) {
+    if (!checked || (offset >= reach_lo && offset <= reach_hi)) {
+        return;
+    }
+    if (offset >= 0) {
+        flush_cells();      // the tape may move and the call clobbers them
+        forget_cells();
+    }
+    emit({ 0x49, 0x8D, 0xB5 });                         // lea rsi, [r13+offset]
+    emit32(offset);
+    if (offset < 0) {
+        emit({ 0x48, 0x85, 0xF6 });                     // test rsi, rsi
+        size_t ok = emit_jcc(CC_NS);
+        emit_underflow();
+        patch(ok);
+        reach_lo = offset;
+    }
+    else {
+        emit({ 0x4C, 0x39, 0xF6 });                     // cmp rsi, r14
+        size_t ok = emit_jcc(CC_L);
+        emit_grow_rsi();
+        patch(ok);
+        reach_hi = offset;
+    }
+}
+
+void JitCompiler::emit_cell_address(int offset) {
+    emit({ 0x4C, 0x89, 0xFF });                         // mov rdi, r15
+    emit({ 0x49, 0x8D, 0xB5 });                         // lea rsi, [r13+offset]
+    emit32(offset);
+}
+
+void JitCompiler::emit_prologue() {
+    emit({ 0x55 });                                     // push rbp
+    emit({ 0x41, 0x54 });                               // push r12
+    emit({ 0x41, 0x55 });                               // push r13
+    emit({ 0x41, 0x56 });                               // push r14
+    emit({ 0x41, 0x57 });                               // push r15
+    emit({ 0x49, 0x89, 0xFF });                         // mov r15, rdi
+    emit_reload();
+    emit({ 0x4D, 0x8B, 0x6F, 0x10 });                   // mov r13, [r15+16]
+}
+
+void JitCompiler::emit_epilogue() {
+    emit({ 0x4D, 0x89, 0x6F, 0x10 });                   // mov [r15+16], r13
+    emit({ 0x41, 0x5F });                               // pop r15
+    emit({ 0x41, 0x5E });                               // pop r14
+    emit({ 0x41, 0x5D });                               // pop r13
+    emit({ 0x41, 0x5C });                               // pop r12
+    emit({ 0x5D });                                     // pop rbp
+    emit({ 0xC3 });                                     // ret
+}
+
+// the cells held in registers follow the pointer, unless the tape may grow
+void JitCompiler::emit_move(int value) {
+    if (checked && value > 0) {
+        flush_cells();
+        forget_cells();
+    }
+    for (auto& cell : cells) {
+        cell.offset -= value;
+    }
+    emit({ 0x49, 0x81, 0xC5 });                         // add r13, value
+    emit32(value);
+    if (value < 0) {
+        // unchecked too: the guard pages only catch accesses
+        size_t ok = emit_jcc(CC_NS);
+        emit_underflow();
+        patch(ok);
+    }
+    else if (checked) {
+        emit({ 0x4D, 0x39, 0xF5 });                     // cmp r13, r14
+        size_t ok = emit_jcc(CC_L);
+        emit({ 0x4C, 0x89, 0xEE });                     // mov rsi, r13
+        emit_grow_rsi();
+        patch(ok);
+    }
+    reach_lo = reach_hi = 0;
+}
+
+// in registers: with every access inside the tape, the targets are updated
+// without a test, a zero cell adding nothing to them; else the targets not
+// held in registers are updated in memory, when the cell is not zero
+void JitCompiler::emit_multiply(const Op& op) {
+    int min_offset = 0;
+    int max_offset = 0;
+    for (const auto& target : op.targets) {
+        min_offset = std::min(min_offset, target.offset);
+        max_offset = std::max(max_offset, target.offset);
+    }
+
+    emit_reach(op.offset);
+    bool reached = !checked ||
+                   (op.offset + min_offset >= reach_lo && op.offset + max_offset <= reach_hi);
+    if (!reached || static_cast<int>(op.targets.size()) >= cell_regs) {
+        emit_multiply_in_memory(op, min_offset, max_offset);
+        return;
+    }
+
+    int source = cache_cell(op.offset, true);
+    uint8_t src = cell_reg[source];
+    size_t done = 0;
+    if (bounded) {
+        for (const auto& target : op.targets) {
+            cache_cell(op.offset + target.offset, true);
+        }
+    }
+    else {
+        emit({ rex(src, src), 0x84, modrm(src, src) }); // test src, src
+        done = emit_jcc(CC_E);
+    }
+
+    for (const auto& target : op.targets) {
+        int slot = find_cell(op.offset + target.offset);
+        int factor = static_cast<int8_t>(target.factor);
+        uint8_t reg = 1;                                // cl
+        if (factor == 1 || factor == -1) {
+            reg = src;
+        }
+        else {
+            emit({ rex(1, src), 0x69, modrm(1, src) }); // imul ecx, src, factor
+            emit32(target.factor);
+        }
+        uint8_t opcode = (factor == -1) ? 0x28 : 0x00;  // sub or add
+        if (slot >= 0) {
+            uint8_t dst = cell_reg[slot];
+            emit({ rex(reg, dst), opcode, modrm(reg, dst) });   // add dst, reg
+            cells[slot].dirty = true;
+        }
+        else {
+            emit_cell(opcode, reg, op.offset + target.offset);  // add byte [cell+target], reg
+        }
+    }
+    emit({ rex(0, src), static_cast<uint8_t>(0xB8 + (src & 7)) });
+    emit32(0);                                          // mov src, 0
+    cells[source].dirty = true;
+
+    if (!bounded) {
+        patch(done);
+    }
+}
+
+void JitCompiler::emit_multiply_in_memory(const Op& op, int min_offset, int max_offset) {
+    flush_cells();
+    forget_cells();
+    emit_cell(0x80, 7, op.offset);                      // cmp byte [cell], 0
+    emit({ 0x00 });
+    size_t done = emit_jcc(CC_E);
+
+    // checks on the taken path do not hold after the op
+    int saved_lo = reach_lo;
+    int saved_hi = reach_hi;
+    emit_reach(op.offset + min_offset);
+    emit_reach(op.offset + max_offset);
+
+    emit({ 0x43, 0x0F, 0xB6, 0x84, 0x2C });             // movzx eax, byte [cell]
+    emit32(op.offset);
+    for (const auto& target : op.targets) {
+        emit({ 0x69, 0xC8 });                           // imul ecx, eax, factor
+        emit32(target.factor);
+        emit_cell(0x00, 1, op.offset + target.offset);  // add byte [cell+target], cl
+    }
+    emit_cell(0xC6, 0, op.offset);                      // mov byte [cell], 0
+    emit({ 0x00 });
+
+    patch(done);
+    reach_lo = saved_lo;
+    reach_hi = saved_hi;
+}
+
+// long scans are left to the vectorized search in BFVM::scan()
+void JitCompiler::emit_scan(int stride) {
+    flush_cells();
+    emit_test_cell(0);
+    size_t done = emit_jcc(CC_E);
+    emit({ 0x4C, 0x89, 0xFF });                         // mov rdi, r15
+    emit({ 0x4C, 0x89, 0xEE });                         // mov rsi, r13
+    emit({ 0x48, 0xC7, 0xC2 });                         // mov rdx, stride
+    emit32(stride);
+    emit_call(reinterpret_cast<void*>(&BFVM<uint8_t>::jit_scan));
+    emit({ 0x49, 0x89, 0xC5 });                         // mov r13, rax
+    emit_reload();
+    patch(done);
+    forget_cells();
+    reach_lo = reach_hi = 0;
+}
+
+// jump back to body while the cell is not zero; with polls, count down the
+// iterations and call BFVM::poll() as the other run loops do, with the
+// tape up to date and the cells of a loop in registers reloaded after it
+void JitCompiler::emit_end_loop(int at_pc, size_t body, bool poll) {
+    emit_test_cell(0);
+    if (!poll) {
+        emit_jcc_to(CC_NE, body);
+        return;
+    }
+    size_t done = emit_jcc(CC_E);
+    emit({ 0x49, 0xFF, 0x4F, 0x20 });                   // dec qword [r15+32]
+    emit_jcc_to(CC_NE, body);
+    store_dirty_cells();
+    emit({ 0x4C, 0x89, 0xFF });                         // mov rdi, r15
+    emit({ 0x4C, 0x89, 0xEE });                         // mov rsi, r13
+    emit({ 0xBA });                                     // mov edx, at_pc
+    emit32(at_pc);
+    emit_call(reinterpret_cast<void*>(&BFVM<uint8_t>::jit_poll));
+    reload_cells();
+    emit({ 0xE9 });                                     // jmp body
+    emit32(static_cast<int32_t>(body - (code.size() + 4)));
+    patch(done);
+}
+
+// An innermost loop that only adds, sets and multiplies cells, with every
+// access inside the tape, keeps its cells in registers across the back
+// edge: they are loaded before the first iteration and written back after
+// the last. offsets: the cells of the loop
+bool JitCompiler::loop_in_registers(const std::vector<Op>& ops, int start, int entry,
+                                    std::vector<int>& offsets) const {
+    if (!bounded) {
+        return false;
+    }
+    offsets.assign(1, 0);
+    auto use = [&](int offset) {
+        if (std::find(offsets.begin(), offsets.end(), offset) == offsets.end()) {
+            offsets.push_back(offset);
+        }
+    };
+    for (int i = start + 1; i < static_cast<int>(ops.size()); i++) {
+        const Op& op = ops[i];
+        switch (op.type) {
+        case OpType::Clear:
+        case OpType::Set:
+        case OpType::Increment:
+            use(op.offset);
+            break;
+        case OpType::Multiply:
+            use(op.offset);
+            for (const auto& target : op.targets) {
+                use(op.offset + target.offset);
+            }
+            break;
+        case OpType::EndLoop:
+            // the entry path comes in with no cells in registers
+            return static_cast<int>(offsets.size()) <= cell_regs && !(entry > start && entry <= i);
+        default:
+            return false;
+        }
+    }
+    return false;
+}
+
+JitCompiler::EntryPoint JitCompiler::compile(const std::vector<Op>& ops, bool checked_, bool bounded_,
+                                             int entry, bool polls) {
+    code.clear();
+    checked = checked_;
+    bounded = bounded_;
+    reach_lo = reach_hi = 0;
+    forget_cells();
+    std::vector<std::pair<size_t, size_t>> loops;      // (body start, exit patch)
+    std::vector<int> offsets;
+    bool in_registers = false;                          // the innermost open loop
+    std::vector<std::pair<int, size_t>> ifs;           // (last op of the body, skip patch)
+
+    emit_prologue();
+    size_t entry_jump = 0;
+    if (entry != 0) {
+        emit({ 0xE9 });                                 // jmp entry
+        entry_jump = code.size();
+        emit32(0);
+    }
+
+    for (int i = 0; i < static_cast<int>(ops.size()); i++) {
+        const Op& op = ops[i];
+        if (i == entry && entry != 0) {
+            flush_cells();
+            patch(entry_jump);
+            forget_cells();
+            reach_lo = reach_hi = 0;    // not checked on the entry path
+        }
+        switch (op.type) {
+        case OpType::Move:
+            emit_move(op.value);
+            break;
+
+        case OpType::Clear:
+        case OpType::Set: {
+            emit_reach(op.offset);
+            int slot = cache_cell(op.offset, false);
+            uint8_t reg = cell_reg[slot];
+            emit({ rex(0, reg), static_cast<uint8_t>(0xB8 + (reg & 7)) });
+            emit32(static_cast<uint8_t>(op.value));     // mov reg, value
+            cells[slot].dirty = true;
+            break;
+        }
+        case OpType::Increment: {
+            emit_reach(op.offset);
+            int slot = cache_cell(op.offset, true);
+            uint8_t reg = cell_reg[slot];
+            emit({ rex(0, reg), 0x80, modrm(0, reg), static_cast<uint8_t>(op.value) });
+            cells[slot].dirty = true;                   // add reg, value
+            break;
+        }
+        case OpType::Multiply:
+            emit_multiply(op);
+            break;
+
+        case OpType::Scan:
+            emit_scan(op.value);
+            break;
+
+        case OpType::StartLoop: {
+            flush_cells();
+            emit_test_cell(0);
+            size_t exit = emit_jcc(CC_E);
+            forget_cells();
+            in_registers = loop_in_registers(ops, i, entry, offsets);
+            if (in_registers) {
+                for (int offset : offsets) {
+                    cache_cell(offset, true);
+                }
+            }
+            loops.push_back({ code.size(), exit });
+            reach_lo = reach_hi = 0;
+            break;
+        }
+        case OpType::EndLoop: {
+            if (loops.empty()) {
+                error("Unmatched ']'");
+            }
+            auto loop = loops.back();
+            loops.pop_back();
+            if (!in_registers) {
+                flush_cells();
+            }
+            emit_end_loop(i, loop.first, polls);
+            flush_cells();
+            patch(loop.second);
+            forget_cells();
+            in_registers = false;
+            reach_lo = reach_hi = 0;
+            break;
+        }
+        case OpType::Input:
+            emit_reach(op.offset);
+            flush_cells();
+            forget_cells();
+            emit_cell_address(op.offset);
+            emit_call(reinterpret_cast<void*>(&BFVM<uint8_t>::jit_input));
+            break;
+
+        case OpType::Output:
+            emit_reach(op.offset);
+            flush_cells();
+            emit_cell_address(op.offset);
+            emit_call(reinterpret_cast<void*>(&BFVM<uint8_t>::jit_output));
+            forget_cells();
+            break;
+
+        case OpType::If:
+            emit_reach(op.offset);
+            flush_cells();
+            emit_test_cell(op.offset);
+            ifs.push_back({ i + op.value, emit_jcc(CC_E) });
+            break;
+
+        default:
+            error("Invalid op");
+        }
+
+        // the checks and registers of the body do not hold on the skip path
+        for (; !ifs.empty() && ifs.back().first == i; ifs.pop_back()) {
+            flush_cells();
+            patch(ifs.back().second);
+            forget_cells();
+            reach_lo = reach_hi = 0;
+        }
+    }
+    if (!loops.empty()) {
+        error("Unmatched '['");
+    }
+    flush_cells();
+    if (entry == static_cast<int>(ops.size()) && entry != 0) {
+        patch(entry_jump);
+    }
+    emit_epilogue();
+
+    return finish();
+}
+
+// copy the code to an executable mapping
+JitCompiler::EntryPoint JitCompiler::finish() {
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    mem_size = (code.size() + page - 1) / page * page;
+    mem = mmap(nullptr, mem_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        mem = nullptr;
+        error("Cannot allocate JIT code buffer");
+    }
+    std::memcpy(mem, code.data(), code.size());
+    if (mprotect(mem, mem_size, PROT_READ | PROT_EXEC) != 0) {
+        error("Cannot make JIT code buffer executable");
+    }
+
+    EntryPoint entry;
+    std::memcpy(&entry, &mem, sizeof(entry));
+    return entry;
+}
+
+// the helpers leave through escape_from_jit() on errors
+template<typename Cell>
+void BFVM<Cell>::jit_grow(JitState* st, int64_t p) {
+    BFVM* vm = st->vm;
+    escape_from_jit([&] { vm->check_ptr(static_cast<int>(p)); });
+    st->base = vm->tape.data();
+    st->size = static_cast<int64_t>(vm->tape.size());
+}
+
+template<typename Cell>
+void BFVM<Cell>::jit_underflow() {
+    escape_from_jit([] { error("Tape pointer underflow"); });
+}
+
+template<typename Cell>
+void BFVM<Cell>::jit_input(JitState* st, int64_t p) {
+    BFVM* vm = st->vm;
+    escape_from_jit([&] { vm->tape[p] = static_cast<uint8_t>(vm->program_input.get()); });
+}
+
+template<typename Cell>
+void BFVM<Cell>::jit_output(JitState* st, int64_t p) {
+    BFVM* vm = st->vm;
+    escape_from_jit([&] { vm->program_output.put(vm->tape[p]); });
+}
+
+template<typename Cell>
+int64_t BFVM<Cell>::jit_scan(JitState* st, int64_t p, int64_t stride) {
+    BFVM* vm = st->vm;
+    int64_t q = 0;
+    escape_from_jit([&] { q = vm->scan(static_cast<int>(stride), static_cast<int>(p)); });
+    st->base = vm->tape.data();
+    st->size = static_cast<int64_t>(vm->tape.size());
+    return q;
+}
+
+// a stop leaves the JIT code with no error
+template<typename Cell>
+void BFVM<Cell>::jit_poll(JitState* st, int64_t p, int64_t at_pc) {
+    BFVM* vm = st->vm;
+    escape_from_jit([&] { st->countdown = vm->poll(static_cast<int>(p), static_cast<int>(at_pc)); });
+    if (st->countdown == 0) {
+        siglongjmp(*escape_point, 1);
+    }
+}
+
+template<typename Cell>
+void BFVM<Cell>::run_jit(bool checked) {
+    if constexpr (!std::is_same<Cell, uint8_t>::value) {
+        // the code generator only emits byte cell accesses
+        if (checked) {
+            run_threaded<true>();
+        }
+        else {
+            run_escapable([&] { run_threaded<false>(); });
+        }
+    }
+    else {
+        bool polls = !checkpoint_file.empty() || step_budget != 0 || time_budget > 0;
+        JitCompiler compiler;
+        JitCompiler::EntryPoint entry = compiler.compile(ops, checked, tape_extent > 0, pc, polls);
+
+        JitState st;
+        st.base = tape.data();
+        st.size = static_cast<int64_t>(tape.size());
+        st.ptr = ptr;
+        st.vm = this;
+        st.countdown = poll_period;
+        run_escapable([&] { entry(&st); });
+        if (status != RunStatus::Finished) {
+            return;     // stopped by poll() at ptr and pc
+        }
+
+        ptr = static_cast<int>(st.ptr);
+        pc = static_cast<int>(ops.size());
+    }
+}
+#else
+template<typename Cell>
+void BFVM<Cell>::run_jit(bool checked) {
+    // no native code generator for this target
+    if (checked) {
+        run_threaded<true>();
+    }
+    else {
+        run_escapable([&] { run_threaded<false>(); });
+    }
+}
+#endif
+
+std::unique_ptr<BFMachine> BFMachine::create(int cell_width) {
+    switch (cell_width) {
+    case 8:
+        return std::unique_ptr<BFMachine>(new BFVM<uint8_t>());
+    case 16:
+        return std::unique_ptr<BFMachine>(new BFVM<uint16_t>());
+    case 32:
+        return std::unique_ptr<BFMachine>(new BFVM<uint32_t>());
+    default:
+        error("Invalid cell width: " + std::to_string(cell_width));
+        return nullptr;
+    }
+}
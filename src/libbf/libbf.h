@@ -0,0 +1,123 @@
+//-----------------------------------------------------------------------------
+// Brainfuck virtual machine library
+// Copyright (c) Paulo Custodio 2026
+// License: The Artistic License 2.0, http ://www.perlfoundation.org/artistic_license_2_0
+//-----------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+// Thrown by the machine on any error: unmatched brackets, tape pointer out
+// of bounds, I/O failures, invalid checkpoints
+class BFError : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+enum class Engine {
+    Switch,     // portable switch dispatch
+    Threaded,   // direct-threaded dispatch through a table of label addresses
+    Jit,        // compile to x86-64 machine code
+    Tiered,     // run the program without the -O3 passes with switch dispatch
+                // until a loop gets hot, then the optimized one as Jit does;
+                // set it before compile_code(), which then skips those passes
+};
+
+enum class FlushPolicy {
+    Auto,       // Line if the output is a terminal, else Exit
+    Line,       // flush on newline and before reading input
+    Exit,       // flush when the buffer is full and at the end of the run
+};
+
+// why run() returned
+enum class RunStatus {
+    Finished,   // the program ran to its end
+    StepLimit,  // the loop iteration budget ran out
+    TimeLimit,  // the time budget ran out
+};
+
+// Caller supplied I/O: read() fills up to size bytes and returns the count,
+// 0 at the end of the input; write() takes size bytes of output
+typedef std::function<size_t(uint8_t* data, size_t size)> ReadCallback;
+typedef std::function<void(const uint8_t* data, size_t size)> WriteCallback;
+
+// A Brainfuck machine: load a program, compile it, then run it any number
+// of times, each run on a fresh tape. Program I/O defaults to stdin and
+// stdout.
+// Separate machines can run on separate threads, but the signal handlers of
+// guarded tapes (SIGSEGV, SIGBUS) and of checkpoints (SIGUSR1) are installed
+// for the whole process while any run needs them, and one SIGUSR1 reaches
+// every machine running with a checkpoint file. A run must not start
+// another run on the same thread from its I/O callbacks.
+class BFMachine {
+public:
+    static std::unique_ptr<BFMachine> create(int cell_width = 8);   // 8, 16 or 32 bits
+    virtual ~BFMachine() = default;
+
+    // the program source
+    virtual void read_code(std::istream& in) = 0;
+    virtual void read_file(const char* filename) = 0;
+    virtual void load_code(const char* text, size_t size) = 0;
+
+    // settings used by compile_code()
+    virtual void set_profile(bool f = true) = 0;
+    virtual void set_tape_profile(bool f = true) = 0;  // profiled runs also count tape accesses
+    virtual void set_pre_exec_steps(long steps) = 0;
+    virtual void set_cache_dir(const std::string& dir) = 0;
+
+    // optimization passes: the -O level, 0 to 3 (default), enables the
+    // passes up to it, then set_pass() turns single ones on or off. The
+    // passes, in their order: offsets and runs (-O1), clears, scans and
+    // multiplies (-O2), values and ifs (-O3)
+    virtual void set_opt_level(int level) = 0;
+    virtual void set_pass(const std::string& name, bool enabled) = 0;
+    // write the ops to out after the pass, "lower" for the unoptimized ops,
+    // or "all" after each; nullptr to stop
+    virtual void set_dump_ir(const std::string& pass, std::ostream* out) = 0;
+
+    virtual void compile_code() = 0;
+    virtual void copy_program(const BFMachine& compiled) = 0;  // of the same cell width
+
+    // settings used by run()
+    virtual void set_trace(bool f = true) = 0;
+    virtual void set_engine(Engine e) = 0;
+    virtual void set_guard_tape(bool f = true) = 0;
+    // write the state to filename on SIGUSR1, which reaches every machine
+    // running with a checkpoint file, and every interval seconds of the
+    // run, 0 for none
+    virtual void set_checkpoint(const std::string& filename, double interval) = 0;
+    virtual void set_budget(uint64_t loop_iterations, double seconds) = 0;     // 0 for no limit
+
+    // program input: a file descriptor, a buffer read in place, or a callback
+    virtual void set_input(int fd) = 0;
+    virtual void set_input(const uint8_t* data, size_t size) = 0;
+    virtual void set_input(ReadCallback read) = 0;
+
+    // program output: a file descriptor, a buffer written in place, which is
+    // an error to overflow, or a callback
+    virtual void set_output(int fd, FlushPolicy policy = FlushPolicy::Auto) = 0;
+    virtual void set_output(uint8_t* data, size_t capacity) = 0;
+    virtual void set_output(WriteCallback write) = 0;
+    virtual uint64_t output_size() const = 0;      // bytes written so far
+    virtual void flush_output() = 0;
+
+    virtual void resume(const std::string& filename) = 0;
+    virtual RunStatus run() = 0;
+
+    virtual void dump_state(std::ostream& out) const = 0;
+    virtual void write_profile(std::ostream& out) const = 0;
+    virtual uint64_t ops_executed() const = 0;     // by the last profiled run
+    // the tape profile of the last profiled run: a summary, and a CSV of the
+    // reads and writes of each cell and the pointer travel per loop
+    virtual void write_tape_profile(std::ostream& out) const = 0;
+    virtual void write_tape_heatmap(std::ostream& out) const = 0;
+    virtual void emit_c(std::ostream& out) const = 0;
+    virtual void write_pass_stats(std::ostream& out) const = 0;    // time and ops per pass
+};
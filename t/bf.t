@@ -6,7 +6,7 @@ use Modern::Perl;
 
 # question mark shows usage
 capture_nok("bf -?", <<'END');
-usage: bf [-t] [-D] [input_file]
+usage: bf [-t] [-p] [-D] [-w 8|16|32] [-O0|-O1|-O2|-O3] [--enable-pass=pass,...] [--disable-pass=pass,...] [--dump-ir=pass] [--pass-stats] [--perf-stats] [--tape-profile=file] [--engine=switch|threaded|jit|tiered] [--guard-tape] [--flush=line|exit] [--pre-exec[=steps]] [--cache[=dir]] [--checkpoint=file [--checkpoint-every=seconds]] [--resume=file] [--emit-c] [--max-iterations=N] [--max-time=seconds] [--batch [--jobs=N] [--out-dir=dir]] [input_file [data_file...]]
 END
 
 # move past the beginning of the tape issues an error
@@ -50,6 +50,21 @@ Tape:  1   2   3
 
 END
 
+# read file with comments, mapped in memory
+spew("$test.bf", "this is a comment before the code\n",
+				 "+ plus > right ++ plus plus > right +++ plus plus plus < left\n",
+				 "and a comment after the code with no commands in it\n");
+capture_ok("bf -D $test.bf", <<'END');
+Tape:  1   2   3 
+         ^^^ (ptr=1)
+
+END
+
+spew("$test.bf", "the loop [ of this comment is not closed\n");
+capture_nok("bf $test.bf", <<'END');
+Error: Unmatched '['
+END
+
 # trace
 spew("$test.bf", "+ > ++");
 capture_ok("bf -t $test.bf", <<'END');
@@ -57,16 +72,46 @@ PC=0 instr=Increment(1)
 Tape:  1 
      ^^^ (ptr=0)
 
-PC=1 instr=Move(1)
-Tape:  1   0 
-         ^^^ (ptr=1)
+PC=1 instr=Increment(2)@1
+Tape:  1   2 
+     ^^^ (ptr=0)
 
-PC=2 instr=Increment(2)
+PC=2 instr=Move(1)
 Tape:  1   2 
          ^^^ (ptr=1)
 
 END
 
+# profile
+spew("$test.bf", "+++[>++++[>+++<--]<-]\n>>[.>]\n,[-]");
+run_ok("bf -p $test.bf < $null > $test.stdout 2> $test.stderr");
+check_text_file("$test.stdout", "\x12");
+check_text_file("$test.stderr", <<'END');
+Profile: 45 ops executed, 18 ops, 3 loops
+
+Hottest loops:
+           ops       %     entries    iterations  ops      source
+            37   82.2%           1             3  1-10     1:4 (offset 3)
+                iterations per entry: 2-3:1
+            21   46.7%           3             6  4-7      1:10 (offset 9)
+                iterations per entry: 2-3:3
+             4    8.9%           1             1  12-15    2:3 (offset 24)
+                iterations per entry: 1:1
+
+Hottest ops:
+         count       %  op     instr                   source
+             6   13.3%  5      Increment(3)@1          1:12 (offset 11)
+             6   13.3%  6      Increment(-2)           1:16 (offset 15)
+             6   13.3%  7      EndLoop(0)              1:18 (offset 17)
+             3    6.7%  2      Increment(4)@1          1:6 (offset 5)
+             3    6.7%  3      Move(1)                 1:5 (offset 4)
+             3    6.7%  4      StartLoop(0)            1:10 (offset 9)
+             3    6.7%  8      Increment(-1)@-1        1:20 (offset 19)
+             3    6.7%  9      Move(-1)                1:19 (offset 18)
+             3    6.7%  10     EndLoop(0)              1:21 (offset 20)
+             1    2.2%  0      Increment(3)            1:1 (offset 0)
+END
+
 # test loops
 spew("$test.bf", "+++ [ - ]");
 capture_ok("bf -D $test.bf", <<'END');
@@ -110,53 +155,71 @@ END
 # test COPY(A,B,T)
 spew("$test.bf", ">+++<[-]>>[-]<[->+<<+>]<[->+<][-]>");
 capture_ok("bf -t $test.bf", <<'END');
-PC=0 instr=Move(1)
-Tape:  0   0 
-         ^^^ (ptr=1)
-
-PC=1 instr=Increment(3)
+PC=0 instr=Increment(3)@1
 Tape:  0   3 
-         ^^^ (ptr=1)
+     ^^^ (ptr=0)
 
-PC=2 instr=Move(-1)
-Tape:  0   3 
+PC=1 instr=Multiply([1:1][-1:1])@1
+Tape:  3   0   3 
      ^^^ (ptr=0)
 
-PC=3 instr=Clear()
-Tape:  0   3 
+PC=2 instr=Multiply([1:1])
+Tape:  0   3   3 
      ^^^ (ptr=0)
 
-PC=4 instr=Move(2)
-Tape:  0   3   0 
-             ^^^ (ptr=2)
+PC=3 instr=Move(1)
+Tape:  0   3   3 
+         ^^^ (ptr=1)
 
-PC=5 instr=Clear()
-Tape:  0   3   0 
-             ^^^ (ptr=2)
+END
 
-PC=6 instr=Move(-1)
+# affine loops: decrement at the end, odd steps, incrementing control cell
+spew("$test.bf", "+++[>+<-]>>+++++[--->+<]>>+[+>++<]");
+capture_ok("bf -t $test.bf", <<'END');
+PC=0 instr=Increment(3)
+Tape:  3 
+     ^^^ (ptr=0)
+
+PC=1 instr=Multiply([1:1])
 Tape:  0   3 
-         ^^^ (ptr=1)
+     ^^^ (ptr=0)
 
-PC=7 instr=Multiply([1:1][-1:1])
-Tape:  3   0   3 
-         ^^^ (ptr=1)
+PC=2 instr=Increment(5)@2
+Tape:  0   3   5 
+     ^^^ (ptr=0)
 
-PC=8 instr=Move(-1)
-Tape:  3   0   3 
+PC=3 instr=Multiply([1:-85])@2
+Tape:  0   3   0  87 
      ^^^ (ptr=0)
 
-PC=9 instr=Multiply([1:1])
-Tape:  0   3   3 
+PC=4 instr=Increment(1)@4
+Tape:  0   3   0  87   1 
      ^^^ (ptr=0)
 
-PC=10 instr=Clear()
-Tape:  0   3   3 
+PC=5 instr=Multiply([1:-2])@4
+Tape:  0   3   0  87   0 254 
      ^^^ (ptr=0)
 
-PC=11 instr=Move(1)
-Tape:  0   3   3 
-         ^^^ (ptr=1)
+PC=6 instr=Move(4)
+Tape:  0   3   0  87   0 254 
+                     ^^^ (ptr=4)
+
+END
+
+# offset addressing: no pointer movement inside a basic block
+spew("$test.bf", ">+>++<<-");
+capture_ok("bf -t $test.bf", <<'END');
+PC=0 instr=Increment(1)@1
+Tape:  0   1 
+     ^^^ (ptr=0)
+
+PC=1 instr=Increment(2)@2
+Tape:  0   1   2 
+     ^^^ (ptr=0)
+
+PC=2 instr=Increment(-1)
+Tape:255   1   2 
+     ^^^ (ptr=0)
 
 END
 
@@ -168,55 +231,35 @@ END
 
 spew("$test.bf", ">>> + > + > + > + > + > + [<]");
 capture_ok("bf -t $test.bf", <<'END');
-PC=0 instr=Move(3)
-Tape:  0   0   0   0 
-                 ^^^ (ptr=3)
-
-PC=1 instr=Increment(1)
+PC=0 instr=Increment(1)@3
 Tape:  0   0   0   1 
-                 ^^^ (ptr=3)
-
-PC=2 instr=Move(1)
-Tape:  0   0   0   1   0 
-                     ^^^ (ptr=4)
+     ^^^ (ptr=0)
 
-PC=3 instr=Increment(1)
+PC=1 instr=Increment(1)@4
 Tape:  0   0   0   1   1 
-                     ^^^ (ptr=4)
-
-PC=4 instr=Move(1)
-Tape:  0   0   0   1   1   0 
-                         ^^^ (ptr=5)
+     ^^^ (ptr=0)
 
-PC=5 instr=Increment(1)
+PC=2 instr=Increment(1)@5
 Tape:  0   0   0   1   1   1 
-                         ^^^ (ptr=5)
-
-PC=6 instr=Move(1)
-Tape:  0   0   0   1   1   1   0 
-                             ^^^ (ptr=6)
+     ^^^ (ptr=0)
 
-PC=7 instr=Increment(1)
+PC=3 instr=Increment(1)@6
 Tape:  0   0   0   1   1   1   1 
-                             ^^^ (ptr=6)
-
-PC=8 instr=Move(1)
-Tape:  0   0   0   1   1   1   1   0 
-                                 ^^^ (ptr=7)
+     ^^^ (ptr=0)
 
-PC=9 instr=Increment(1)
+PC=4 instr=Increment(1)@7
 Tape:  0   0   0   1   1   1   1   1 
-                                 ^^^ (ptr=7)
+     ^^^ (ptr=0)
 
-PC=10 instr=Move(1)
-Tape:  0   0   0   1   1   1   1   1   0 
-                                     ^^^ (ptr=8)
+PC=5 instr=Increment(1)@8
+Tape:  0   0   0   1   1   1   1   1   1 
+     ^^^ (ptr=0)
 
-PC=11 instr=Increment(1)
+PC=6 instr=Move(8)
 Tape:  0   0   0   1   1   1   1   1   1 
                                      ^^^ (ptr=8)
 
-PC=12 instr=Scan(-1)
+PC=7 instr=Scan(-1)
 Tape:  0   0   0   1   1   1   1   1   1 
              ^^^ (ptr=2)
 
@@ -228,55 +271,672 @@ PC=0 instr=Increment(1)
 Tape:  1 
      ^^^ (ptr=0)
 
-PC=1 instr=Move(1)
-Tape:  1   0 
+PC=1 instr=Increment(1)@1
+Tape:  1   1 
+     ^^^ (ptr=0)
+
+PC=2 instr=Increment(1)@2
+Tape:  1   1   1 
+     ^^^ (ptr=0)
+
+PC=3 instr=Increment(1)@3
+Tape:  1   1   1   1 
+     ^^^ (ptr=0)
+
+PC=4 instr=Increment(1)@4
+Tape:  1   1   1   1   1 
+     ^^^ (ptr=0)
+
+PC=5 instr=Increment(1)@5
+Tape:  1   1   1   1   1   1 
+     ^^^ (ptr=0)
+
+PC=6 instr=Scan(1)
+Tape:  1   1   1   1   1   1   0 
+                             ^^^ (ptr=6)
+
+END
+
+# engines
+spew("$test.bf", "+");
+capture_nok("bf --engine=xpto $test.bf", <<'END');
+Error: Unknown engine: xpto
+END
+
+for my $opts (map {("--engine=$_", "--engine=$_ --guard-tape", "--engine=$_ --pre-exec", "--engine=$_ --pre-exec=7")}
+			  qw( switch threaded jit tiered )) {
+	spew("$test.bf", ">+++<[-]>>[-]<[->+<<+>]<[->+<][-]>");
+	capture_ok("bf $opts -D $test.bf", <<'END');
+Tape:  0   3   3 
          ^^^ (ptr=1)
 
-PC=2 instr=Increment(1)
-Tape:  1   1 
+END
+
+	# static pointer range: the tape is allocated up front and run unchecked
+	spew("$test.bf", ">>++[-<<+>>>>>+<<<]>>>>>>+<<<<<<<");
+	capture_ok("bf $opts -D $test.bf", <<'END');
+Tape:  2   0   0   0   0   2   0   0   1 
          ^^^ (ptr=1)
 
-PC=3 instr=Move(1)
-Tape:  1   1   0 
-             ^^^ (ptr=2)
+END
 
-PC=4 instr=Increment(1)
-Tape:  1   1   1 
-             ^^^ (ptr=2)
+	spew("$test.bf", "+ > + > + > + > + > + [<]");
+	capture_nok("bf $opts $test.bf", <<'END');
+Error: Tape pointer underflow
+END
+
+	spew("$test.bf", ">>+>+[<<+>]");
+	capture_nok("bf $opts $test.bf", <<'END');
+Error: Tape pointer underflow
+END
+
+	# the pointer passes below cell 0 between two accesses, which the guard
+	# pages alone do not see
+	spew("$test.bf", ">[>]<<>>>+.");
+	capture_nok("bf -O0 $opts $test.bf > $test.stdout", <<'END');
+Error: Tape pointer underflow
+END
+	spew("$test.in", "L\xa4\xe3");
+	spew("$test.bf", ">[>>>]--.-----[->>+++<<][[----[----][+>-<]]>>>[+[-]][--->+<]][>>]<<[>+<-]>+<[-----[--->+<][+>-<]<[-]][-[--->+<]>+<>>>>]>>>>>,[>+<-]+++++[+++++[-]]");
+	capture_nok("bf -O3 $opts $test.bf < $test.in > $test.stdout", <<'END');
+Error: Tape pointer underflow
+END
+
+	spew("$test.bf", "+++[>+<-]>>+++++[--->+<]>>+[+>++<]>>[>+<--]");
+	capture_ok("bf $opts -D $test.bf", <<'END');
+Tape:  0   3   0  87   0 254   0 
+                             ^^^ (ptr=6)
+
+END
+
+	spew("$test.bf", "+ > + > + > + > + > + <<<<< [>] +++ [ > ++ [ > +++ < - ] < - ]");
+	capture_ok("bf $opts -D $test.bf", <<'END');
+Tape:  1   1   1   1   1   1   0   0  18 
+                             ^^^ (ptr=6)
+
+END
+
+	# strided scans, long enough for the vectorized search
+	spew("$test.bf", ">" . "+>" x 40 . "<[<<]>" . "+>>" x 20 . "<" x 40 . "[>>]");
+	capture_ok("bf $opts -D $test.bf", <<'END');
+Tape:  0   2   1   2   1   2   1   2   1   2   1   2   1   2   1   2   1   2   1   2   1   2   1   2   1   2   1   2   1   2   1   2   1   2   1   2   1   2   1   2   1   0 
+                                                                                                                                                                         ^^^ (ptr=41)
+
+END
+
+	spew("$test.bf", ">+>+>+>+>+>+>+[<<<]");
+	capture_nok("bf $opts $test.bf", <<'END');
+Error: Tape pointer underflow
+END
+
+	my $prog = "";
+	for (split //, "Hello\n") {
+		$prog .= ("+" x ord($_)).". [-] ";
+	}
+	spew("$test.bf", $prog);
+	capture_ok("bf $opts $test.bf", <<'END');
+Hello
+END
+
+	spew("$test.in", "!");
+	spew("$test.bf", ",>,<");
+	capture_ok("bf $opts -D $test.bf < $test.in", <<'END');
+Tape: 33 255 
+     ^^^ (ptr=0)
+
+END
+}
+
+# cell widths
+spew("$test.bf", "+");
+capture_nok("bf -w 12 $test.bf", <<'END');
+Error: Invalid cell width: 12
+END
+
+my %wide = (
+	16 => { max => 65535, inverse => 43691 },
+	32 => { max => 4294967295, inverse => 2863311531 },
+);
+for my $width (sort keys %wide) {
+	my $max = $wide{$width}{max};
+	my $inverse = $wide{$width}{inverse};
+	for my $opts (map {("--engine=$_", "--engine=$_ --guard-tape", "--engine=$_ --pre-exec")}
+				  qw( switch threaded jit tiered )) {
+		# wrap-around below zero, and EOF reads as all ones
+		spew("$test.in", "");
+		spew("$test.bf", "->,");
+		capture_ok("bf -w $width $opts -D $test.bf < $test.in", <<END);
+Tape:$max $max 
+         ^^^ (ptr=1)
+
+END
+
+		# no wrap at 256
+		spew("$test.bf", "+" x 256 . "[>+<-]>");
+		capture_ok("bf -w $width $opts -D $test.bf", <<END);
+Tape:  0 256 
+         ^^^ (ptr=1)
+
+END
+
+		# affine loop: the control cell reaches zero after 1/3 iterations
+		spew("$test.bf", "+[>+<---]");
+		capture_ok("bf -w $width $opts -D $test.bf", <<END);
+Tape:  0 $inverse 
+     ^^^ (ptr=0)
+
+END
+
+		# output writes the low byte
+		spew("$test.bf", "+" x (256 + 65) . ".");
+		capture_ok("bf -w $width $opts $test.bf", "A");
+	}
+
+	spew("$test.bf", "+[>+<---]>.");
+	run_ok("bf -w $width --emit-c $test.bf > $test.c");
+	run_ok("cc -o $test.exe $test.c");
+	capture_ok("./$test.exe", chr($inverse & 0xFF));
+	capture_ok("bf -w $width $test.bf", chr($inverse & 0xFF));
+}
+
+# checkpoint and resume
+spew("$test.bf", "+");
+capture_nok("bf --checkpoint=$test.ck --checkpoint-every=0 $test.bf", <<'END');
+Error: Invalid checkpoint interval: 0
+END
+capture_nok("bf --checkpoint-every=1 $test.bf", <<'END');
+Error: --checkpoint-every needs --checkpoint
+END
+unlink("$test.ck");
+capture_nok("bf --resume=$test.ck $test.bf", <<END);
+Error: Cannot open checkpoint: $test.ck
+END
+spew("$test.ck", "BFCK");
+capture_nok("bf --resume=$test.ck $test.bf", <<END);
+Error: Invalid checkpoint: $test.ck
+END
+
+# the loop runs long enough for the timer to request checkpoints; the
+# resumed run skips the input read before the checkpoint, and continues
+# the output file from the output written before it
+spew("$test.in", "ab");
+spew("$test.bf", ",.-[>-[>--[--]<-]<-],.");
+for my $engine (qw( switch threaded jit tiered )) {
+	unlink("$test.ck");
+	capture_ok("bf --engine=$engine --checkpoint=$test.ck --checkpoint-every=0.001 $test.bf < $test.in", "ab");
+	ok -f "$test.ck", "checkpoint $test.ck written";
+
+	spew("$test.out", "a-garbage");
+	run_ok("bf --engine=$engine --resume=$test.ck -D $test.bf < $test.in 1<> $test.out");
+	check_text_file("$test.out", <<'END');
+abTape: 98 
+     ^^^ (ptr=0)
+
+END
+}
+
+spew("$test.bf", ",.-[>-[>--[--]<-]<-],+.");
+capture_nok("bf --resume=$test.ck $test.bf < $test.in", <<END);
+Error: Checkpoint does not match the program: $test.ck
+END
+capture_nok("bf -w 16 --resume=$test.ck $test.bf < $test.in", <<END);
+Error: Checkpoint does not match the program: $test.ck
+END
+
+# SIGUSR1 requests a checkpoint, with no interval the run writes none
+# until then
+if ($^O ne 'MSWin32') {
+	spew("$test.bf", ",.-[>-[>-[>--[--]<-]<-]<-],.");
+	unlink("$test.ck");
+	run_nok("bf --checkpoint=$test.ck --max-time=0.2 $test.bf < $test.in > $test.out 2> $null");
+	ok !-f "$test.ck", "no checkpoint without SIGUSR1";
+	run_ok("sh -c 'bf --checkpoint=$test.ck --max-time=1 $test.bf < $test.in > $test.out 2> $null & ".
+		   "sleep 0.3; kill -USR1 \$!; wait \$!; test \$? = 1'");
+	is substr(slurp("$test.ck"), 0, 4), "BFCK", "checkpoint on SIGUSR1";
+}
+
+# compiled program cache: a second run loads the ops and the pre-executed
+# state from the cache, a damaged cache file is compiled again
+sub cache_hit {
+	my($cmd) = @_;
+	run_ok("$cmd --pass-stats 2> $test.stats");
+	return slurp("$test.stats") =~ /loaded from the cache/ ? 1 : 0;
+}
+
+path("$test.cache")->remove_tree;
+spew("$test.in", "!");
+spew("$test.bf", "++++++++[>++++++++<-]>+.>+++[>+++<-]<<,.>[-]");
+for my $opts ("", "--pre-exec", "-w 16", "--engine=jit --pre-exec", "-t", "-O1") {
+	run_ok("bf $opts -D $test.bf < $test.in > $test.exp");
+	for my $run (1 .. 2) {
+		my $hit = cache_hit("bf --cache=$test.cache $opts -D $test.bf < $test.in > $test.out");
+		is $hit, 1, "cache run $run with '$opts' loads" if $run == 2;
+		is slurp("$test.out"), slurp("$test.exp"), "cache run $run with '$opts'";
+	}
+}
+my @cached = glob("$test.cache/*.bfc");
+is scalar(@cached), 4, "one cache file per cell width, pre-exec budget and pass set";
+for my $file (@cached) {
+	my $data = slurp($file);
+	spew($file, substr($data, 0, length($data) - 3));
+}
+is cache_hit("bf --cache=$test.cache $test.bf < $test.in > $test.out"), 0, "truncated cache file";
+is slurp("$test.out"), "A!", "truncated cache file compiled again";
+is cache_hit("bf --cache=$test.cache $test.bf < $test.in > $test.out"), 1, "cache file rewritten";
+
+# the If and Set ops of the ifs pass are cached too, a flipped bit is caught
+# by the checksum
+path("$test.cache")->remove_tree;
+spew("$test.in", "AB");
+spew("$test.bf", ",>,<[>[-]+++<[-]]>.");
+is cache_hit("bf --cache=$test.cache $test.bf < $test.in > $test.out"), 0, "If op compiles";
+is cache_hit("bf --cache=$test.cache $test.bf < $test.in > $test.out"), 1, "If op loads";
+is slurp("$test.out"), "\x03", "If op loaded from the cache";
+my($file) = glob("$test.cache/*.bfc");
+my $data = slurp($file);
+substr($data, length($data) / 2, 1) ^= "\x10";
+spew($file, $data);
+is cache_hit("bf --cache=$test.cache $test.bf < $test.in > $test.out"), 0, "flipped bit";
+is slurp("$test.out"), "\x03", "flipped bit compiled again";
+path("$test.cache")->remove_tree;
+
+# batch: one compile, the inputs run on a pool of threads, the outputs
+# reported in input order, framed on stdout or written to a directory
+spew("$test.bf", ",+[-.,+]");
+spew("$test.in1", "hello\n");
+spew("$test.in2", "");
+spew("$test.in3", "world\n");
+for my $opts ("", "--jobs=1", "--jobs=3 --engine=threaded", "--jobs=2 --engine=jit --pre-exec", "--jobs=2 --engine=tiered", "-w 16") {
+	capture_ok("bf --batch $opts $test.bf $test.in1 $test.in2 $test.in3", <<END);
+#bf ok 6 $test.in1
+hello
+#bf ok 0 $test.in2
+#bf ok 6 $test.in3
+world
+END
+}
+
+spew("$test.bf", "+>,----------[<]++++++++++.");
+spew("$test.in2", "\n");
+for my $opts ("", "--engine=jit", "--engine=threaded --guard-tape", "--engine=jit --guard-tape") {
+	run_nok("bf --batch --jobs=2 $opts $test.bf $test.in1 $test.in2 $test.none $test.in3 > $test.stdout 2> $test.stderr");
+	check_text_file("$test.stdout", <<END);
+#bf error 0 $test.in1
+#bf ok 1 $test.in2
+
+#bf error 0 $test.none
+#bf error 0 $test.in3
+END
+	check_text_file("$test.stderr", <<END);
+Error: $test.in1: Tape pointer underflow
+Error: $test.none: Cannot open file: $test.none
+Error: $test.in3: Tape pointer underflow
+END
+}
+
+spew("$test.bf", ",+[-.,+]");
+path("$test.dir")->remove_tree;
+path("$test.dir")->mkpath;
+capture_ok("bf --batch --out-dir=$test.dir $test.bf $test.in1 $test.in2 $test.in3", "");
+check_text_file("$test.dir/$test.in1", "hello\n");
+check_text_file("$test.dir/$test.in2", "\n");
+check_text_file("$test.dir/$test.in3", "world\n");
+path("$test.dir")->remove_tree;
+
+capture_nok("bf --batch -t $test.bf $test.in1", <<END);
+Error: --batch cannot be used with -t, -p, -D, --emit-c, --perf-stats, --tape-profile, --checkpoint or --resume
+END
+capture_nok("bf --jobs=2 $test.bf", <<END);
+Error: --jobs and --out-dir need --batch
+END
+capture_nok("bf --batch --jobs=0 $test.bf", <<END);
+Error: Invalid job count: 0
+END
+run_nok("bf $test.bf $test.in1 2> $test.stderr");
+
+# budgets of loop iterations and run time
+spew("$test.bf", "++++[>+++++<-]>[<+++>-]<+++++.>+[]");
+for my $engine ("switch", "threaded", "jit", "tiered") {
+	run_nok("bf --engine=$engine --max-iterations=1000 $test.bf > $test.stdout 2> $test.stderr");
+	check_text_file("$test.stdout", "A");
+	check_text_file("$test.stderr", "Error: Loop iteration budget exhausted\n");
+	run_nok("bf --engine=$engine --max-time=0.1 $test.bf > $test.stdout 2> $test.stderr");
+	check_text_file("$test.stdout", "A");
+	check_text_file("$test.stderr", "Error: Time budget exhausted\n");
+}
+spew("$test.bf", "++++[>+++++<-]>[<+++>-]<+++++.");
+capture_ok("bf --max-iterations=24 $test.bf", "A");
+capture_nok("bf --max-iterations=0 $test.bf", <<'END');
+Error: Invalid iteration budget: 0
+END
+capture_nok("bf --max-time=x $test.bf", <<'END');
+Error: Invalid time budget: x
+END
+# the jit holds the cells of the inner loop in registers, and still counts
+# each iteration
+spew("$test.bf", "++++++++++[>++++++++++<-]>[-->[-]+>+<<]>>.");
+for my $engine ("switch", "threaded", "jit", "tiered") {
+	capture_ok("bf --engine=$engine --max-iterations=50 -D $test.bf", <<'END');
+2Tape:  0   0   1  50 
+                 ^^^ (ptr=3)
+
+END
+	capture_nok("bf --engine=$engine --max-iterations=49 $test.bf", <<'END');
+Error: Loop iteration budget exhausted
+END
+}
+
+# pre-execution of the program up to the first input
+spew("$test.bf", "+");
+capture_nok("bf --pre-exec=x $test.bf", <<'END');
+Error: Invalid step budget: x
+END
+
+spew("$test.in", "!");
+spew("$test.bf", "++++++++[>++++++++<-]>+.,");
+capture_ok("bf --pre-exec -t $test.bf < $test.in", <<'END');
+APC=4 instr=Input(0)@1
+Tape:  0  33 
+     ^^^ (ptr=0)
 
 PC=5 instr=Move(1)
-Tape:  1   1   1   0 
+Tape:  0  33 
+         ^^^ (ptr=1)
+
+END
+
+# known cell values: dead loops, redundant clears and folded writes
+spew("$test.in", "\0");
+spew("$test.bf", "[.]+++[-]".("+" x 33).".>,[-]".("+" x 65).".<");
+capture_ok("bf -t $test.bf < $test.in", <<'END');
+PC=0 instr=Increment(33)
+Tape: 33 
+     ^^^ (ptr=0)
+
+PC=1 instr=Output(0)
+!Tape: 33 
+     ^^^ (ptr=0)
+
+PC=2 instr=Input(0)@1
+Tape: 33 
+     ^^^ (ptr=0)
+
+PC=3 instr=Set(65)@1
+Tape: 33  65 
+     ^^^ (ptr=0)
+
+PC=4 instr=Output(0)@1
+ATape: 33  65 
+     ^^^ (ptr=0)
+
+END
+
+# loops that run at most once become Ifs: one ends with a clear of its
+# cell, the other decrements a cell known to be 0 or 1
+spew("$test.bf", "+>,[<->[-]]<[>>".("+" x 65).".<<-]");
+spew("$test.in", "x");
+capture_ok("bf -t $test.bf < $test.in", <<'END');
+PC=0 instr=Increment(1)
+Tape:  1 
+     ^^^ (ptr=0)
+
+PC=1 instr=Input(0)@1
+Tape:  1 120 
+     ^^^ (ptr=0)
+
+PC=2 instr=If(2)@1
+Tape:  1 120 
+     ^^^ (ptr=0)
+
+PC=3 instr=Increment(-1)
+Tape:  0 120 
+     ^^^ (ptr=0)
+
+PC=4 instr=Clear()@1
+Tape:  0 
+     ^^^ (ptr=0)
+
+PC=5 instr=If(3)
+Tape:  0 
+     ^^^ (ptr=0)
+
+END
+
+for my $opts ("--engine=switch", "--engine=threaded", "--engine=jit", "--engine=tiered", "--pre-exec") {
+	spew("$test.in", "\0");
+	capture_ok("bf $opts -D $test.bf < $test.in", <<'END');
+ATape:  0   0  65 
+     ^^^ (ptr=0)
+
+END
+}
+
+# cells before the start of the tape are not known to be zero: the clear of
+# cell -1 stays and underflows
+spew("$test.bf", ">>>[>>>]<<<<[-]>>>>+.");
+capture_nok("bf -O3 $test.bf", <<'END');
+Error: Tape pointer underflow
+END
+
+# tiered execution: the inner loop gets hot after 10000 iterations, and the
+# run continues there in the optimized program, within the same budget
+spew("$test.bf", "++++++++++[>++++++++++[>----[-->+<]<-]<-]>>>.");
+for my $opts ("", "--guard-tape", "--pre-exec") {
+	run_ok("bf --engine=switch $opts -D $test.bf > $test.exp");
+	run_ok("bf --engine=tiered $opts -D $test.bf > $test.out");
+	is slurp("$test.out"), slurp("$test.exp"), "tiered run with '$opts'";
+}
+capture_ok("bf --engine=tiered -w 16 -D $test.bf", <<'END');
+8Tape:  0   0   0 65336 
                  ^^^ (ptr=3)
 
-PC=6 instr=Increment(1)
-Tape:  1   1   1   1 
+END
+# the optimized program is cached after the run, from its start state and
+# not from the tape at the hot loop
+for my $opts ("", "--pre-exec=100") {
+	path("$test.cache")->remove_tree;
+	run_ok("bf --engine=jit $opts -D $test.bf > $test.exp");
+	is cache_hit("bf --engine=tiered --cache=$test.cache $opts -D $test.bf > $test.out"), 0, "tiered run compiles";
+	is slurp("$test.out"), slurp("$test.exp"), "tiered run with --cache $opts";
+	for my $engine (qw( jit tiered )) {
+		is cache_hit("bf --engine=$engine --cache=$test.cache $opts -D $test.bf > $test.out"), 1,
+		   "$engine run loads the tiered run cache with '$opts'";
+		is slurp("$test.out"), slurp("$test.exp"), "$engine run from the tiered run cache with '$opts'";
+	}
+}
+path("$test.cache")->remove_tree;
+capture_ok("bf --engine=tiered --max-iterations=12600 $test.bf", "8");
+capture_nok("bf --engine=tiered --max-iterations=12599 $test.bf", <<'END');
+Error: Loop iteration budget exhausted
+END
+
+# optimization passes: each -O level and each pass alone gives the same
+# result, in more ops
+spew("$test.in", "!");
+spew("$test.bf", "++++++++[>++++++++<-]>+.>+++[>+++<-]<<,.>[-]<[>]>>[-]+[->[-]<]");
+for my $opts ("-O0", "-O1", "-O2", "-O3", "-O0 --enable-pass=values,ifs", "--disable-pass=offsets,runs",
+			  (map {"-O0 --enable-pass=$_"} qw( clears scans multiplies offsets runs values ifs ))) {
+	for my $engine (qw( switch jit tiered )) {
+		capture_ok("bf $opts --engine=$engine -D $test.bf < $test.in", <<'END');
+A!Tape: 33   0   0   0 
                  ^^^ (ptr=3)
 
-PC=7 instr=Move(1)
-Tape:  1   1   1   1   0 
-                     ^^^ (ptr=4)
+END
+	}
+}
 
-PC=8 instr=Increment(1)
-Tape:  1   1   1   1   1 
-                     ^^^ (ptr=4)
+spew("$test.bf", "++[->+++<]>>[-]<<[>]");
+run_ok("bf -O2 --dump-ir=multiplies $test.bf 2> $test.stderr");
+check_text_file("$test.stderr", <<'END');
+IR after multiplies: 9 ops
+     0  Increment(1)
+     1  Increment(1)
+     2  Multiply([1:3])
+     3  Move(1)
+     4  Move(1)
+     5  Clear()
+     6  Move(-1)
+     7  Move(-1)
+     8  Scan(1)
+END
+run_ok("bf -O2 --disable-pass=scans --dump-ir=runs $test.bf 2> $test.stderr");
+check_text_file("$test.stderr", <<'END');
+IR after runs: 6 ops
+     0  Increment(2)
+     1  Multiply([1:3])
+     2  Clear()@2
+     3  StartLoop(0)
+     4    Move(1)
+     5  EndLoop(0)
+END
+run_ok("bf --pass-stats $test.bf 2> $test.stderr");
+my $stats = slurp("$test.stderr");
+like $stats, qr/^  pass +ms +ops +change$/m, "pass stats header";
+for my $pass (qw( lower clears scans multiplies offsets runs values ifs total )) {
+	like $stats, qr/^  $pass +\d+\.\d{3}/m, "pass stats of $pass";
+}
+like $stats, qr/^  lower +\d+\.\d{3} +20 +\+0 \(0\.0%\)$/m, "lower has one op per command";
 
-PC=9 instr=Move(1)
-Tape:  1   1   1   1   1   0 
-                         ^^^ (ptr=5)
+capture_nok("bf -O4 $test.bf", <<'END');
+usage: bf [-t] [-p] [-D] [-w 8|16|32] [-O0|-O1|-O2|-O3] [--enable-pass=pass,...] [--disable-pass=pass,...] [--dump-ir=pass] [--pass-stats] [--perf-stats] [--tape-profile=file] [--engine=switch|threaded|jit|tiered] [--guard-tape] [--flush=line|exit] [--pre-exec[=steps]] [--cache[=dir]] [--checkpoint=file [--checkpoint-every=seconds]] [--resume=file] [--emit-c] [--max-iterations=N] [--max-time=seconds] [--batch [--jobs=N] [--out-dir=dir]] [input_file [data_file...]]
+END
+capture_nok("bf --disable-pass=runs,xpto $test.bf", <<'END');
+Error: Unknown pass: xpto
+END
+capture_nok("bf --dump-ir=xpto $test.bf", <<'END');
+Error: Unknown pass: xpto
+END
 
-PC=10 instr=Increment(1)
-Tape:  1   1   1   1   1   1 
-                         ^^^ (ptr=5)
+# performance counters: the counters the kernel refuses are not counted,
+# the ops are counted in a second, profiled run on the same input
+spew("$test.in", "hello\n");
+spew("$test.bf", ",+[-.,+]");
+run_ok("bf -p $test.bf < $test.in > $test.stdout 2> $test.stderr");
+my($profile_ops) = slurp("$test.stderr") =~ /^Profile: (\d+) ops executed/m;
+for my $opts ("", "--engine=jit", "--engine=tiered", "-p") {
+	run_ok("bf --perf-stats $opts $test.bf < $test.in > $test.stdout 2> $test.stderr");
+	check_text_file("$test.stdout", "hello\n");
+	my $perf = slurp("$test.stderr");
+	like $perf, qr/^Perf stats:\n  ops executed +$profile_ops\n/m, "perf stats ops with '$opts'";
+	for my $counter (qw( cycles instructions branch-misses L1d-read-misses task-clock )) {
+		like $perf, qr/^  $counter +(\d+( \(scaled\))?|\d+\.\d{3} ms|not counted)$/m, "perf stats $counter with '$opts'";
+	}
+	like $perf, qr/^  cpu time +\d+\.\d{3} ms/m, "perf stats cpu time with '$opts'";
+	like $perf, qr/^  ops\/second +\d+$/m, "perf stats ops/second with '$opts'";
+}
+capture_nok("bf --perf-stats --resume=$test.ck $test.bf", <<'END');
+Error: --perf-stats cannot be used with --resume
+END
+capture_nok("bf --batch --perf-stats $test.bf $test.in", <<'END');
+Error: --batch cannot be used with -t, -p, -D, --emit-c, --perf-stats, --tape-profile, --checkpoint or --resume
+END
 
-PC=11 instr=Move(-5)
-Tape:  1   1   1   1   1   1 
-     ^^^ (ptr=0)
+# tape profile: at -O0 the travel is the < and > executed
+spew("$test.bf", "++++[>++<-]>[>+>+<<-]>>.");
+run_ok("bf -O0 --tape-profile=$test.csv $test.bf > $test.stdout 2> $test.stderr");
+check_text_file("$test.stdout", "\x08");
+check_text_file("$test.csv", <<'END');
+loop,line,column,cell,reads,writes,travel
+top,,,*,5,4,3
+top,,,0,4,4,
+top,,,3,1,0,
+4,1,5,*,17,12,8
+4,1,5,0,9,4,
+4,1,5,1,8,8,
+12,1,13,*,33,24,32
+12,1,13,1,17,8,
+12,1,13,2,8,8,
+12,1,13,3,8,8,
+END
+check_text_file("$test.stderr", <<'END');
+Tape profile: 4 cells, 55 reads, 40 writes, pointer travel 43
+Pointer moves: 43 of 98 ops executed (43.9%)
+
+Most pointer travel:
+        travel  ops           source
+             3  top           -
+            32  12-20         1:13 (offset 12)
+             8  4-10          1:5 (offset 4)
+
+Most accessed cells:
+    cell         reads        writes
+       1            25            16
+       0            13             8
+       3             9             8
+       2             8             8
+END
 
-PC=12 instr=Scan(1)
-Tape:  1   1   1   1   1   1   0 
-                             ^^^ (ptr=6)
+# multiplies touch the targets, scans every cell they pass
+spew("$test.bf", "++++[>++<-]>[>+>+<<-]>>.<[<]");
+run_ok("bf --tape-profile=$test.csv $test.bf > $test.stdout 2> $test.stderr");
+check_text_file("$test.csv", <<'END');
+loop,line,column,cell,reads,writes,travel
+top,,,*,9,6,3
+top,,,0,2,2,
+top,,,1,3,2,
+top,,,2,2,1,
+top,,,3,2,1,
+END
+like slurp("$test.stderr"), qr/^Pointer moves: 2 of 6 ops executed \(33\.3%\)$/m, "tape profile pointer moves";
+
+run_ok("bf -p --tape-profile=$test.csv $test.bf > $test.stdout 2> $test.stderr");
+like slurp("$test.stderr"), qr/^Profile: 6 ops executed.*^Tape profile: 4 cells/ms, "profile and tape profile";
+
+capture_nok("bf --tape-profile=$test.nodir/x.csv $test.bf > $test.stdout", <<"END");
+Error: Cannot create file: $test.nodir/x.csv
+END
+
+# buffered output
+spew("$test.bf", "+");
+capture_nok("bf --flush=xpto $test.bf", <<'END');
+Error: Unknown flush policy: xpto
+END
 
+for my $opts ("", "--flush=line", "--flush=exit") {
+	spew("$test.in", "hello\nworld\n\0");
+	spew("$test.bf", ",[.,]");
+	capture_ok("bf $opts $test.bf < $test.in", <<'END');
+hello
+world
 END
 
+	# output is flushed before the error is reported
+	spew("$test.bf", "+" x 65 . ".>+>+[<<]");
+	run_nok("bf $opts $test.bf > $test.stdout 2> $test.stderr");
+	check_text_file("$test.stdout", "A");
+	check_text_file("$test.stderr", "Error: Tape pointer underflow\n");
+}
+
+# emit C
+sub emit_c_ok {
+	my($prog, $in, $exp_out) = @_;
+	local $Test::Builder::Level = $Test::Builder::Level + 1;
+
+	spew("$test.bf", $prog);
+	spew("$test.in", $in);
+	run_ok("bf --emit-c $test.bf > $test.c");
+	run_ok("cc -o $test.exe $test.c");
+	capture_ok("bf $test.bf < $test.in", $exp_out);
+	capture_ok("./$test.exe < $test.in", $exp_out);
+}
+
+emit_c_ok("++++++++[>++++[>++>+++>+++>+<<<<-]>+>+>->>+[<]<-]>>.>---.+++++++..+++.>>.<-.<.+++.------.--------.>>+.", 
+		  "", "Hello World!");
+emit_c_ok(",[.,]", "echo\n\0", "echo\n");
+emit_c_ok(">>>+>+>+[<]>[.>]", "", "\x01\x01\x01");
+emit_c_ok("+>+>+>+<<<[>]+++++[->+++++++++<]>+++++.", "", "2");
+emit_c_ok(">" . "+>" x 40 . "<[<<]>" . "+>>" x 20 . "<" x 40 . "[>>]<[.<<]", "", "\x01" x 20);
+emit_c_ok(">" x 5000 . "+++++[-<+>]<" . "+" x 43 . ".", "", "0");
+emit_c_ok("+>,[<->[-]]<[>>" . "+" x 65 . ".<<-]", "\0", "A");
+
+for my $prog ("+ > + > + > + > + > + [<]", ">>+>+[<<+>]") {
+	spew("$test.bf", $prog);
+	run_ok("bf --emit-c $test.bf > $test.c");
+	run_ok("cc -o $test.exe $test.c");
+	capture_nok("./$test.exe", <<'END');
+Error: Tape pointer underflow
+END
+}
+
 unlink_testfiles;
 done_testing;